@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+#	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+#	Copyright (C) 2023-2023 Johannes Bauer
+#
+#	This file is part of toy_x64_bootloader.
+#
+#	toy_x64_bootloader is free software; you can redistribute it and/or modify
+#	it under the terms of the GNU General Public License as published by
+#	the Free Software Foundation; this program is ONLY licensed under
+#	version 3 of the License, later versions are explicitly excluded.
+#
+#	toy_x64_bootloader is distributed in the hope that it will be useful,
+#	but WITHOUT ANY WARRANTY; without even the implied warranty of
+#	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#	GNU General Public License for more details.
+#
+#	You should have received a copy of the GNU General Public License
+#	along with toy_x64_bootloader; if not, write to the Free Software
+#	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+#	Johannes Bauer <JohannesBauer@gmx.de>
+
+import collections
+
+class BootTrace():
+	"""Parser for the boot trace that stage 2 writes to the debugcon port and
+	COM1 (see longmode_example_common_trace.c). Every event that is not an
+	ATA command starts a new phase which lasts until the next one."""
+	_ATA_EVENTS = ("ata_command", "ata_done")
+	Event = collections.namedtuple("Event", [ "tsc", "name", "arg" ])
+	Phase = collections.namedtuple("Phase", [ "name", "start_ms", "duration_ms", "ata_commands", "ata_busy_ms" ])
+
+	def __init__(self, tsc_hz, events, dropped = 0):
+		self._tsc_hz = tsc_hz
+		self._events = events
+		self._dropped = dropped
+
+	@classmethod
+	def parse(cls, text):
+		"""Returns the last complete trace found in the text or None."""
+		trace = None
+		current = None
+		for line in text.splitlines():
+			if not line.startswith("trace: "):
+				continue
+			fields = line.split()[1:]
+			if fields[0] == "begin":
+				header = dict(field.split("=", maxsplit = 1) for field in fields[1:])
+				current = { "tsc_hz": int(header["tsc_hz"]), "dropped": int(header["dropped"]), "events": [ ] }
+			elif current is None:
+				continue
+			elif fields[0] == "end":
+				trace = cls(current["tsc_hz"], current["events"], current["dropped"])
+				current = None
+			else:
+				current["events"].append(cls.Event(tsc = int(fields[0], 16), name = fields[1], arg = int(fields[2], 16)))
+		return trace
+
+	@classmethod
+	def parse_file(cls, filename):
+		with open(filename, errors = "replace") as f:
+			return cls.parse(f.read())
+
+	@property
+	def dropped(self):
+		return self._dropped
+
+	def _ms(self, ticks):
+		return ticks * 1000 / self._tsc_hz
+
+	def ata_commands(self):
+		"""List of (start_tsc, duration_ms, arg) for each ATA command; a
+		command without completion event lasts until the next event."""
+		commands = [ ]
+		for (index, event) in enumerate(self._events):
+			if event.name != "ata_command":
+				continue
+			if index + 1 < len(self._events):
+				commands.append((event.tsc, self._ms(self._events[index + 1].tsc - event.tsc), event.arg))
+		return commands
+
+	def phases(self):
+		marks = [ event for event in self._events if event.name not in self._ATA_EVENTS ]
+		commands = self.ata_commands()
+		phases = [ ]
+		for (mark, next_mark) in zip(marks, marks[1:]):
+			in_phase = [ duration for (tsc, duration, arg) in commands if mark.tsc <= tsc < next_mark.tsc ]
+			phases.append(self.Phase(name = mark.name, start_ms = self._ms(mark.tsc), duration_ms = self._ms(next_mark.tsc - mark.tsc), ata_commands = len(in_phase), ata_busy_ms = sum(in_phase)))
+		return phases
+
+	def total_ms(self):
+		"""Time from the first to the last phase mark."""
+		marks = [ event for event in self._events if event.name not in self._ATA_EVENTS ]
+		if len(marks) < 2:
+			return 0
+		return self._ms(marks[-1].tsc - marks[0].tsc)
+
+	def end_ms(self):
+		"""Time from reset to the last phase mark."""
+		marks = [ event for event in self._events if event.name not in self._ATA_EVENTS ]
+		if len(marks) == 0:
+			return 0
+		return self._ms(marks[-1].tsc)
+
+	def print_breakdown(self):
+		print(f"Boot trace: {len(self._events)} events, {self._dropped} dropped, TSC at {self._tsc_hz / 1e6:.1f} MHz")
+		print(f"{'Phase':<24s} {'Start [ms]':>12s} {'Duration [ms]':>14s} {'ATA cmds':>9s} {'ATA busy [ms]':>14s}")
+		for phase in self.phases():
+			print(f"{phase.name:<24s} {phase.start_ms:12.3f} {phase.duration_ms:14.3f} {phase.ata_commands:9d} {phase.ata_busy_ms:14.3f}")
+		print(f"{'Total':<24s} {'':12s} {self.total_ms():14.3f}")
+		commands = self.ata_commands()
+		if len(commands) > 0:
+			durations = [ duration for (tsc, duration, arg) in commands ]
+			print(f"ATA: {len(commands)} commands, min {min(durations):.3f} ms, avg {sum(durations) / len(durations):.3f} ms, max {max(durations):.3f} ms")
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+#	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+#	Copyright (C) 2023-2023 Johannes Bauer
+#
+#	This file is part of toy_x64_bootloader.
+#
+#	toy_x64_bootloader is free software; you can redistribute it and/or modify
+#	it under the terms of the GNU General Public License as published by
+#	the Free Software Foundation; this program is ONLY licensed under
+#	version 3 of the License, later versions are explicitly excluded.
+#
+#	toy_x64_bootloader is distributed in the hope that it will be useful,
+#	but WITHOUT ANY WARRANTY; without even the implied warranty of
+#	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#	GNU General Public License for more details.
+#
+#	You should have received a copy of the GNU General Public License
+#	along with toy_x64_bootloader; if not, write to the Free Software
+#	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+#	Johannes Bauer <JohannesBauer@gmx.de>
+
+class LZ4():
+	"""Compressor for the LZ4 block format (no frame), greedy matching with
+	a single entry hash table. Ratio is below the reference implementation,
+	but the output is a valid block that any LZ4 decoder accepts."""
+	_MIN_MATCH = 4
+	_MAX_OFFSET = 65535
+	_LAST_LITERALS = 5		# The last five bytes are always literals
+	_MF_LIMIT = 12			# The last match must start at least 12 bytes before the end
+
+	@classmethod
+	def _encode_length(cls, length):
+		encoded = bytearray()
+		while length >= 255:
+			encoded.append(255)
+			length -= 255
+		encoded.append(length)
+		return encoded
+
+	@classmethod
+	def _emit_sequence(cls, output, literals, offset = None, match_length = None):
+		literal_nibble = min(len(literals), 15)
+		match_nibble = 0 if (match_length is None) else min(match_length - cls._MIN_MATCH, 15)
+		output.append((literal_nibble << 4) | match_nibble)
+		if literal_nibble == 15:
+			output += cls._encode_length(len(literals) - 15)
+		output += literals
+		if match_length is not None:
+			output += offset.to_bytes(length = 2, byteorder = "little")
+			if match_nibble == 15:
+				output += cls._encode_length(match_length - cls._MIN_MATCH - 15)
+
+	@classmethod
+	def compress(cls, data):
+		data = bytes(data)
+		output = bytearray()
+		table = { }
+		anchor = 0
+		pos = 0
+		match_start_limit = len(data) - cls._MF_LIMIT
+		match_end_limit = len(data) - cls._LAST_LITERALS
+		while pos < match_start_limit:
+			key = data[pos : pos + cls._MIN_MATCH]
+			candidate = table.get(key)
+			table[key] = pos
+			if (candidate is None) or (pos - candidate > cls._MAX_OFFSET):
+				pos += 1
+				continue
+
+			match_length = cls._MIN_MATCH
+			while (pos + match_length < match_end_limit) and (data[candidate + match_length] == data[pos + match_length]):
+				match_length += 1
+			cls._emit_sequence(output, data[anchor : pos], pos - candidate, match_length)
+			pos += match_length
+			anchor = pos
+		cls._emit_sequence(output, data[anchor : ])
+		return bytes(output)
+
+	@classmethod
+	def decompress(cls, data):
+		output = bytearray()
+		pos = 0
+		while True:
+			token = data[pos]
+			pos += 1
+			literal_length = token >> 4
+			if literal_length == 15:
+				while True:
+					literal_length += data[pos]
+					pos += 1
+					if data[pos - 1] != 255:
+						break
+			output += data[pos : pos + literal_length]
+			pos += literal_length
+			if pos == len(data):
+				return bytes(output)
+
+			offset = int.from_bytes(data[pos : pos + 2], byteorder = "little")
+			pos += 2
+			match_length = token & 0x0f
+			if match_length == 15:
+				while True:
+					match_length += data[pos]
+					pos += 1
+					if data[pos - 1] != 255:
+						break
+			match_length += cls._MIN_MATCH
+			for _ in range(match_length):
+				output.append(output[-offset])
+
+if __name__ == "__main__":
+	import os
+	for plaintext in [ b"", b"a", b"abcd" * 1000, os.urandom(1000), open(__file__, "rb").read() ]:
+		compressed = LZ4.compress(plaintext)
+		assert(LZ4.decompress(compressed) == plaintext)
+		print(f"{len(plaintext)} -> {len(compressed)} bytes")
@@ -49,52 +49,201 @@
 	.long (\flags) | (\base & 0xff000000) | ((\base & 0x00ff0000) >> 16) | (\limit & 0xf0000)
 .endm
 
+# Handoff of the BIOS memory map to stage 1, must match
+# longmode_example_common_bootinfo.h
+.equ E820_COUNT_ADDR,		0x500
+.equ E820_MAP_ADDR,			0x508
+.equ E820_MAX_ENTRIES,		64
+.equ E820_ENTRY_SIZE,		24
+.equ E820_SMAP,				0x534d4150		# "SMAP"
+
+# Boot trace timestamps, must match longmode_example_common_trace.h
+.equ TRACE_STAGE0_MAIN,		0xc00
+.equ TRACE_STAGE0_PMODE,	0xc08
+
+# Partition table entries in the loaded MBR
+.equ PARTITION1_ENTRY,		0x7c00 + 446
+.equ PARTITION2_ENTRY,		0x7c00 + 446 + 16
+.equ PARTITION_LBA,			8
+.equ PARTITION_SECTORS,		12
+
+.equ STAGE1_SEGMENT,		0x800			# Linear 0x8000
+.equ EDD_MAX_SECTORS,		127				# Per AH=42h call, the limit of many BIOSes
+.equ DISK_RETRIES,			3
+
+# Built with "-Wa,--defsym,STAGE0_UNREAL=1" (build --stage0-loader unreal),
+# stage 0 also loads partition 2 above 1 MiB through unreal mode; must match
+# longmode_example_common_bootinfo.h
+.ifndef STAGE0_UNREAL
+.equ STAGE0_UNREAL,			0
+.endif
+.equ PRELOAD_INFO_ADDR,		0xc18
+.equ PRELOAD_ADDR,			0x1000000		# 16 MiB
+.equ BOUNCE_SEGMENT,		0x2000			# Linear 0x20000, the later trace ring
+
+# Store the TSC at a fixed address, clobbers %eax and %edx
+.macro trace_stamp address
+	rdtsc
+	mov %eax, \address
+	mov %edx, \address + 4
+.endm
+
 
 .code16
 .text
 
 .globl main
 main:
-	# Initialize stack pointer
+	# Initialize stack pointer, DL holds the boot drive
 	xor %ax, %ax
 	mov %ax, %ss
 	mov $0x7fff, %sp
+	mov %ax, %ds
+	mov %ax, %es
+	mov %dl, boot_drive
+	trace_stamp TRACE_STAGE0_MAIN
 
 	# Set VGA video mode, 80x25 (clears screen)
 	mov $0x03, %ax
-	mov $0, %bx
 	int $0x10
 
-	# Show first message
+.if !STAGE0_UNREAL
+	# Show first message (the unreal mode loader needs the space)
 	mov $str_stage0_init, %si
 	call print_string
+.endif
 
-	# Target memory 0x8000 = 0000:8000 = 0800:0000
-	mov $0x800, %ax
-	mov %ax, %es
-	mov $0x0, %bx	
-
-	# Load 128 sectors to 0x8000
-	mov $2, %ah			# Read
-	mov $128, %al		# number of sectors to read
-	mov $0, %ch			# cylinder
-	mov $2, %cl			# sector
-	mov $0, %dh			# head
-	mov $0x80, %dl		# first hard drive
+	# Collect the BIOS memory map, it is only available in real mode
+	xor %ebx, %ebx
+	mov %ebx, E820_COUNT_ADDR
+	mov $E820_MAP_ADDR, %di
+	e820_next_entry:
+		mov $0xe820, %eax
+		mov $E820_ENTRY_SIZE, %ecx
+		mov $E820_SMAP, %edx
+		movl $1, %es:20(%di)		# ACPI 3.0 attributes "valid", in case the BIOS only returns 20 bytes
+		int $0x15
+		jc e820_done
+		cmp $E820_SMAP, %eax
+		jne e820_done
+		incl E820_COUNT_ADDR
+		add $E820_ENTRY_SIZE, %di
+		cmp $(E820_MAP_ADDR + (E820_MAX_ENTRIES * E820_ENTRY_SIZE)), %di
+		jae e820_done
+		test %ebx, %ebx
+	jnz e820_next_entry
+	e820_done:
+
+	# The EDD packet functions are required (fixed disk access subset)
+	mov $0x41, %ah
+	mov $0x55aa, %bx
+	mov boot_drive, %dl
 	int $0x13
+	jc disk_error
+	cmp $0xaa55, %bx
+	jne disk_error
+	test $1, %cl
+	jz disk_error
 
+	# Load exactly partition 1 to 0x8000 in as few calls as possible
+	mov $PARTITION1_ENTRY, %bx
+	xor %edi, %edi
+	call load_partition
+
+.if STAGE0_UNREAL
+	# Load partition 2 (stage 2) to 16 MiB, stage 1 then reads it from there
+	movw $BOUNCE_SEGMENT, dap_segment
+	mov $PARTITION2_ENTRY, %bx
+	mov $PRELOAD_ADDR, %edi
+	mov %edi, PRELOAD_INFO_ADDR
+	call load_partition
+.endif
 	jmp switch_to_protected_mode
 
+# Read the partition whose table entry %bx points to, either to dap_segment
+# (%edi = 0) or through a bounce buffer at dap_segment to linear %edi
+load_partition:
+	mov PARTITION_LBA(%bx), %eax
+	mov %eax, dap_lba
+	mov PARTITION_SECTORS(%bx), %ecx	# All 32 bits, stage 2 may exceed 65535 sectors
+	load_partition_next_chunk:
+		mov $EDD_MAX_SECTORS, %ax
+		cmp $EDD_MAX_SECTORS, %ecx
+		jae load_partition_chunk_size
+			mov %cx, %ax
+		load_partition_chunk_size:
+		mov %ax, dap_count
+		mov $DISK_RETRIES, %bp
+		load_partition_retry:
+			mov $0x42, %ah
+			mov boot_drive, %dl
+			mov $dap, %si
+			int $0x13
+			jnc load_partition_chunk_done
+			dec %bp
+		jnz load_partition_retry
+		jmp disk_error
+		load_partition_chunk_done:
+		movzwl dap_count, %eax
+		add %eax, dap_lba
+		sub %eax, %ecx
+		pushf				# Zero flag: partition done
+		shl $5, %ax			# Sectors to paragraphs
+.if STAGE0_UNREAL
+		test %edi, %edi
+		jz load_partition_advance
+			call enter_unreal_mode
+			push %ecx
+			movzwl %ax, %ecx
+			shl $2, %ecx		# Paragraphs to dwords
+			mov $(BOUNCE_SEGMENT << 4), %esi
+			addr32 rep movsl	# Advances %edi
+			pop %ecx
+			xor %ax, %ax
+		load_partition_advance:
+.endif
+		add %ax, dap_segment
+		popf
+	jnz load_partition_next_chunk
+	ret
+
+.if STAGE0_UNREAL
+# Load %ds and %es with 4 GiB limits in protected mode and return to real
+# mode, where the limits stay. Redone for every copy, since the BIOS may
+# switch modes and reset the limits during int 13h.
+enter_unreal_mode:
+	cli
+	cld
+	push %ds
+	push %es
+	lgdt (gdt_desc)
+	mov %cr0, %edx
+	inc %dx				# PE
+	mov %edx, %cr0
+	mov $16, %si
+	mov %si, %ds
+	mov %si, %es
+	dec %dx
+	mov %edx, %cr0
+	pop %es
+	pop %ds
+	sti
+	ret
+.endif
+
 switch_to_protected_mode:
 	# Disable IRQs
 	cli
+	trace_stamp TRACE_STAGE0_PMODE
 
 	# Load GDT
 	lgdt (gdt_desc)
 
+.if !STAGE0_UNREAL
 	# Last message in real mode (afterwards we do not have BIOS INTs)
 	mov $str_stage0_switch_protected_mode, %si
 	call print_string
+.endif
 
 	# Prepare switch to protected mode
 	mov $1, %ax
@@ -114,11 +263,23 @@ print_string:
 print_string_finished:
     ret
 
+disk_error:
+	mov $str_stage0_disk_error, %si
+	call print_string
+	disk_error_halt:
+		hlt
+	jmp disk_error_halt
+
+.if !STAGE0_UNREAL
 str_stage0_init:
 	.string "stage0: video mode initialized\r\n"
 
 str_stage0_switch_protected_mode:
 	.string "stage0: will now switch into protected mode\r\n"
+.endif
+
+str_stage0_disk_error:
+	.string "stage0: disk error\r\n"
 
 .code32
 init_32bit:
@@ -133,19 +294,32 @@ init_32bit:
 	# set a new stack pointer at 2 MiB
 	mov $0x200000, %esp
 	
-	# load the entry point at 0x8000 from the IVT
-	movl 0x8000, %eax
-
-	# start the main program in 32 bit mode
-	jmp *%eax
+	# start the main program in 32 bit mode, its entry point is at 0x8000
+	# in the IVT
+	jmp *0x8000
 
 .section .data
+# The CPU never reads the null descriptor, so it holds the GDT descriptor
 gdt:
-	gdt_entry_null:	segment_descriptor 0, 0, 0
+	gdt_desc:
+		.word gdt_end - gdt - 1		# size of GDT
+		.long gdt					# offset of GDT
+		.word 0
 	gdt_entry_cs: 	segment_descriptor 0, 0xfffff, SD_SEGTYPE_CODE_RX | SD_P | SD_DB | SD_G
 	gdt_entry_ds: 	segment_descriptor 0, 0xfffff, SD_SEGTYPE_DATA_RW | SD_P | SD_DB | SD_G
 gdt_end:
 
-gdt_desc:
-	.word gdt_end - gdt - 1		# size of GDT
-	.long gdt					# offset of GDT
+# EDD disk address packet
+dap:
+	.byte 16					# size of packet
+	.byte 0
+dap_count:
+	.word 0						# sectors to transfer
+	.word 0						# buffer offset
+dap_segment:
+	.word STAGE1_SEGMENT		# buffer segment
+dap_lba:
+	.quad 0
+
+boot_drive:
+	.byte 0
@@ -0,0 +1,87 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_COMMON_BOOTINFO_H__
+#define __LONGMODE_EXAMPLE_COMMON_BOOTINFO_H__
+
+#include <stdint.h>
+
+/* Stage 0 leaves the BIOS memory map here (the addresses are repeated in
+ * the stage 0 assembly code) */
+#define BOOTINFO_E820_COUNT_ADDR	0x500
+#define BOOTINFO_E820_MAP_ADDR		0x508
+#define BOOTINFO_E820_MAX_ENTRIES	64
+
+#define E820_TYPE_RAM				1
+#define E820_TYPE_RESERVED			2
+#define E820_TYPE_ACPI				3
+#define E820_TYPE_NVS				4
+#define E820_TYPE_UNUSABLE			5
+
+/* Stage 0 built with the unreal mode loader copies partition 2 to
+ * STAGE0_PRELOAD_ADDR and leaves that address here (the addresses are
+ * repeated in the stage 0 assembly code) */
+#define STAGE0_PRELOAD_INFO_ADDR	0xc18
+#define STAGE0_PRELOAD_ADDR			0x1000000
+
+/* Stage 0 and 1 code, their stack and the stage 1 page tables all live
+ * below this address */
+#define BOOTINFO_LOADER_END			0x200000
+
+/* Stage 1 maps all of physical memory here and stage 2 keeps using these
+ * page tables */
+#define PHYSMAP_BASE				0xffff800000000000ULL
+
+struct e820_entry_t {
+	uint64_t base;
+	uint64_t length;
+	uint32_t type;
+	uint32_t acpi_attributes;
+} __attribute__ ((packed));
+
+_Static_assert(sizeof(struct e820_entry_t) == 24, "E820 entry not 24 bytes long");
+
+/* Whether the stages run their microbenchmarks on every boot, set by the
+ * build script's --microbench option */
+#ifndef MICROBENCH
+#define MICROBENCH					0
+#endif
+
+/* Set by the build script in the stage 2 header */
+#define BOOT_FLAG_EXIT_WHEN_INITIALIZED	(1 << 0)	/* Leave QEMU through isa-debug-exit */
+
+/* Handed from stage 1 to the stage 2 entry point. The memory map is sorted
+ * by base address and contains no empty entries. */
+struct bootinfo_t {
+	uint32_t e820_count;
+	struct e820_entry_t e820[BOOTINFO_E820_MAX_ENTRIES];
+	uint64_t stage2_phys_base;
+	uint64_t stage2_window_size;
+	uint64_t low_page_table;		/* Physical address of the 4 kiB page table mapping the first 2 MiB */
+	uint64_t tsc_hz;				/* As calibrated by stage 1 */
+	uint64_t trace_buffer;			/* Physical address of the boot trace ring */
+	uint64_t serial_ring;			/* Physical address of the COM1 output ring, 0 without UART */
+	uint32_t boot_flags;
+};
+
+#endif
@@ -0,0 +1,260 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_serial.h"
+#include "longmode_example_common_vgacon.h"
+#include "longmode_example_common_string.h"
+
+static void print_char(uint8_t color, uint8_t character) {
+	if (CONSOLE_OUTPUTS & CONSOLE_OUTPUT_SERIAL) {
+		serial_putc(character);
+	}
+	if (CONSOLE_OUTPUTS & CONSOLE_OUTPUT_VGA) {
+		vgacon_putc(color, character);
+	}
+}
+
+/* Continue below whatever the previous stage left on the screen */
+void console_init(void) {
+	if (CONSOLE_OUTPUTS & CONSOLE_OUTPUT_VGA) {
+		vgacon_init();
+	}
+}
+
+void cursor_set_line(unsigned int y) {
+	if (CONSOLE_OUTPUTS & CONSOLE_OUTPUT_VGA) {
+		vgacon_set_line(y);
+		vgacon_flush();
+	}
+}
+
+void cursor_newline(void) {
+	if (CONSOLE_OUTPUTS & CONSOLE_OUTPUT_VGA) {
+		vgacon_newline();
+	}
+}
+
+/* The screen is updated once per message */
+void printmsg(const char *message) {
+	while (*message) {
+		if (*message == '\n') {
+			if (CONSOLE_OUTPUTS & CONSOLE_OUTPUT_SERIAL) {
+				serial_putc('\r');
+				serial_putc('\n');
+			}
+			cursor_newline();
+		} else {
+			print_char(0x07, *message);
+		}
+		message++;
+	}
+	if (CONSOLE_OUTPUTS & CONSOLE_OUTPUT_VGA) {
+		vgacon_flush();
+	}
+}
+
+/* Writes exactly "digits" zero padded hex digits and a terminating NUL */
+void format_hex(char *buffer, uint64_t value, unsigned int digits) {
+	buffer[digits] = 0;
+	for (int i = digits - 1; i >= 0; i--) {
+		buffer[i] = "0123456789abcdef"[value & 0xf];
+		value >>= 4;
+	}
+}
+
+static void print_hex(uint64_t value, unsigned int digits) {
+	char buffer[17];
+	format_hex(buffer, value, digits);
+	printmsg(buffer);
+}
+
+void print_byte(uint8_t byte) {
+	print_hex(byte, 2);
+}
+
+void print_uint32(uint32_t integer) {
+	print_hex(integer, 8);
+}
+
+void print_uint64(uint64_t integer) {
+	print_hex(integer, 16);
+}
+
+/* Writes the digits right aligned, ending at "end", and returns the first */
+char *format_unsigned(char *end, uint64_t value, unsigned int base, bool uppercase) {
+	const char *digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+	char *digit = end;
+	do {
+		*--digit = digits[value % base];
+		value /= base;
+	} while (value);
+	return digit;
+}
+
+void print_decimal(uint64_t integer) {
+	char buffer[21];
+	buffer[20] = 0;
+	printmsg(format_unsigned(buffer + 20, integer, 10, false));
+}
+
+/* Output is collected and handed to printmsg() in pieces, so the screen is
+ * updated once per call in the common case */
+struct printfmt_buffer_t {
+	char data[128];
+	unsigned int fill;
+};
+
+static void printfmt_putc(struct printfmt_buffer_t *buffer, char character) {
+	if (buffer->fill == sizeof(buffer->data) - 1) {
+		buffer->data[buffer->fill] = 0;
+		printmsg(buffer->data);
+		buffer->fill = 0;
+	}
+	buffer->data[buffer->fill++] = character;
+}
+
+static void printfmt_field(struct printfmt_buffer_t *buffer, const char *text, size_t length, unsigned int width, char pad, bool left_align) {
+	if (!left_align) {
+		for (size_t i = length; i < width; i++) {
+			printfmt_putc(buffer, pad);
+		}
+	}
+	for (size_t i = 0; i < length; i++) {
+		printfmt_putc(buffer, text[i]);
+	}
+	if (left_align) {
+		for (size_t i = length; i < width; i++) {
+			printfmt_putc(buffer, ' ');
+		}
+	}
+}
+
+/* Subset of printf(): flags "0" and "-", a field width, the length
+ * modifiers "l", "ll" and "z" and the conversions d, i, u, x, X, p, c, s and
+ * %. It is not called printf() because GCC would rewrite some calls of that
+ * to puts() and putchar(). */
+void printfmt(const char *format, ...) {
+	struct printfmt_buffer_t buffer = { .fill = 0 };
+	va_list ap;
+	va_start(ap, format);
+	while (*format) {
+		if (*format != '%') {
+			printfmt_putc(&buffer, *format++);
+			continue;
+		}
+		format++;
+
+		bool left_align = false;
+		char pad = ' ';
+		for (; (*format == '-') || (*format == '0'); format++) {
+			if (*format == '-') {
+				left_align = true;
+			} else {
+				pad = '0';
+			}
+		}
+		unsigned int width = 0;
+		for (; (*format >= '0') && (*format <= '9'); format++) {
+			width = (width * 10) + (*format - '0');
+		}
+		unsigned int long_count = 0;
+		for (; (*format == 'l') || (*format == 'z'); format++) {
+			long_count = (*format == 'z') ? 2 : long_count + 1;
+		}
+
+		char number[24];
+		char *const number_end = number + sizeof(number);
+		const char conversion = *format;
+		if (conversion) {
+			format++;
+		}
+		switch (conversion) {
+			case 'd':
+			case 'i':
+				{
+					const int64_t value = (long_count > 0) ? va_arg(ap, int64_t) : va_arg(ap, int);
+					char *text = format_unsigned(number_end, (value < 0) ? -(uint64_t)value : (uint64_t)value, 10, false);
+					if (value < 0) {
+						if (pad == '0') {
+							printfmt_putc(&buffer, '-');
+							width = width ? width - 1 : 0;
+						} else {
+							*--text = '-';
+						}
+					}
+					printfmt_field(&buffer, text, number_end - text, width, pad, left_align);
+				}
+				break;
+
+			case 'u':
+			case 'x':
+			case 'X':
+				{
+					const uint64_t value = (long_count > 0) ? va_arg(ap, uint64_t) : va_arg(ap, unsigned int);
+					const char *text = format_unsigned(number_end, value, (conversion == 'u') ? 10 : 16, conversion == 'X');
+					printfmt_field(&buffer, text, number_end - text, width, pad, left_align);
+				}
+				break;
+
+			case 'p':
+				{
+					const char *text = format_unsigned(number_end, (uintptr_t)va_arg(ap, void*), 16, false);
+					printfmt_field(&buffer, "0x", 2, 0, ' ', false);
+					printfmt_field(&buffer, text, number_end - text, 16, '0', false);
+				}
+				break;
+
+			case 'c':
+				number[0] = va_arg(ap, int);
+				printfmt_field(&buffer, number, 1, width, ' ', left_align);
+				break;
+
+			case 's':
+				{
+					const char *text = va_arg(ap, const char*);
+					printfmt_field(&buffer, text, strlen(text), width, ' ', left_align);
+				}
+				break;
+
+			case '%':
+				printfmt_putc(&buffer, '%');
+				break;
+
+			default:
+				/* Unknown conversion, show it verbatim */
+				printfmt_putc(&buffer, '%');
+				if (conversion) {
+					printfmt_putc(&buffer, conversion);
+				}
+				break;
+		}
+	}
+	va_end(ap);
+	buffer.data[buffer.fill] = 0;
+	printmsg(buffer.data);
+}
@@ -0,0 +1,56 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_COMMON_CONSOLE_H__
+#define __LONGMODE_EXAMPLE_COMMON_CONSOLE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CONSOLE_OUTPUT_VGA		(1 << 0)
+#define CONSOLE_OUTPUT_SERIAL	(1 << 1)
+
+/* Where printmsg() and friends write to in both stages, set by the build
+ * script's --console option */
+#ifndef CONSOLE_OUTPUTS
+#define CONSOLE_OUTPUTS			(CONSOLE_OUTPUT_VGA | CONSOLE_OUTPUT_SERIAL)
+#endif
+
+/* Lets GCC check the arguments against the format string */
+void printfmt(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+void console_init(void);
+void cursor_set_line(unsigned int y);
+void cursor_newline(void);
+void printmsg(const char *message);
+void format_hex(char *buffer, uint64_t value, unsigned int digits);
+void print_byte(uint8_t byte);
+void print_uint32(uint32_t integer);
+void print_uint64(uint64_t integer);
+char *format_unsigned(char *end, uint64_t value, unsigned int base, bool uppercase);
+void print_decimal(uint64_t integer);
+void printfmt(const char *format, ...);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -0,0 +1,114 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "longmode_example_common_cpu.h"
+#include "longmode_example_common_io.h"
+
+#define CPUID_STRUCTURED_FEATURES	0x00000007
+#define CPUID_EDX_SSE2				(1 << 26)
+#define CPUID_ECX_SSE3				(1 << 0)
+#define CPUID_ECX_SSSE3				(1 << 9)
+#define CPUID_ECX_SSE4_1			(1 << 19)
+#define CPUID_ECX_SSE4_2			(1 << 20)
+#define CPUID_ECX_POPCNT			(1 << 23)
+#define CPUID_ECX_OSXSAVE			(1 << 27)
+#define CPUID_ECX_AVX				(1 << 28)
+#define CPUID_7_EBX_AVX2			(1 << 5)
+#define CPUID_7_EBX_BMI2			(1 << 8)
+#define CPUID_7_EBX_ERMS			(1 << 9)
+#define CPUID_7_EDX_FSRM			(1 << 4)
+
+#define CR4_OSFXSR					(1 << 9)
+#define XCR0_SSE					(1 << 1)
+#define XCR0_AVX					(1 << 2)
+
+static const char *feature_names[] = {
+	[0] = "sse2",
+	[1] = "sse3",
+	[2] = "ssse3",
+	[3] = "sse4.1",
+	[4] = "sse4.2",
+	[5] = "popcnt",
+	[6] = "avx",
+	[7] = "avx2",
+	[8] = "bmi2",
+	[9] = "erms",
+	[10] = "fsrm",
+};
+
+static uint32_t cpu_detect_features(void) {
+	const struct cpuid_t leaf1 = cpuid(CPUID_FEATURES, 0);
+	const struct cpuid_t leaf7 = (cpuid(0, 0).eax >= CPUID_STRUCTURED_FEATURES) ? cpuid(CPUID_STRUCTURED_FEATURES, 0) : (struct cpuid_t) { 0 };
+	uint32_t features = 0;
+
+	/* Instructions that work regardless of the SIMD register state */
+	features |= (leaf1.ecx & CPUID_ECX_POPCNT) ? CPU_FEATURE_POPCNT : 0;
+	features |= (leaf7.ebx & CPUID_7_EBX_BMI2) ? CPU_FEATURE_BMI2 : 0;
+	features |= (leaf7.ebx & CPUID_7_EBX_ERMS) ? CPU_FEATURE_ERMS : 0;
+	features |= (leaf7.edx & CPUID_7_EDX_FSRM) ? CPU_FEATURE_FSRM : 0;
+
+	/* SSE is only usable once stage 1 has set CR4.OSFXSR */
+	uint64_t cr4;
+	__asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+	if (!(cr4 & CR4_OSFXSR)) {
+		return features;
+	}
+	features |= (leaf1.edx & CPUID_EDX_SSE2) ? CPU_FEATURE_SSE2 : 0;
+	features |= (leaf1.ecx & CPUID_ECX_SSE3) ? CPU_FEATURE_SSE3 : 0;
+	features |= (leaf1.ecx & CPUID_ECX_SSSE3) ? CPU_FEATURE_SSSE3 : 0;
+	features |= (leaf1.ecx & CPUID_ECX_SSE4_1) ? CPU_FEATURE_SSE4_1 : 0;
+	features |= (leaf1.ecx & CPUID_ECX_SSE4_2) ? CPU_FEATURE_SSE4_2 : 0;
+
+	/* AVX additionally needs the YMM state enabled in XCR0 */
+	if (!(leaf1.ecx & CPUID_ECX_OSXSAVE) || !(leaf1.ecx & CPUID_ECX_AVX) || ((xgetbv(0) & (XCR0_SSE | XCR0_AVX)) != (XCR0_SSE | XCR0_AVX))) {
+		return features;
+	}
+	features |= CPU_FEATURE_AVX;
+	features |= (leaf7.ebx & CPUID_7_EBX_AVX2) ? CPU_FEATURE_AVX2 : 0;
+	return features;
+}
+
+/* Not a feature but the mark of a cache that is not filled yet. Being non
+ * zero, it also places the cache in .data: stage 2 calls cpu_features()
+ * (through memzero()) before it has cleared its .bss. */
+#define CPU_FEATURES_UNKNOWN		(1UL << 31)
+
+/* Features that can be used right now, i.e. that the CPU has and, for the
+ * SIMD extensions, that stage 1 or the AP trampoline enabled. All CPUs are
+ * set up the same way, so racing first calls store the same value. */
+uint32_t cpu_features(void) {
+	static uint32_t features = CPU_FEATURES_UNKNOWN;
+	uint32_t cached = __atomic_load_n(&features, __ATOMIC_RELAXED);
+	if (cached & CPU_FEATURES_UNKNOWN) {
+		cached = cpu_detect_features();
+		__atomic_store_n(&features, cached, __ATOMIC_RELAXED);
+	}
+	return cached;
+}
+
+const char *cpu_feature_name(unsigned int bit) {
+	return (bit < sizeof(feature_names) / sizeof(feature_names[0])) ? feature_names[bit] : NULL;
+}
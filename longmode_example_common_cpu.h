@@ -0,0 +1,55 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_COMMON_CPU_H__
+#define __LONGMODE_EXAMPLE_COMMON_CPU_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Code that uses SIMD registers has to opt in per function with
+ * __attribute__ ((target ("..."))) and check for the feature first. The
+ * stages are compiled with -mgeneral-regs-only because interrupt handlers
+ * do not save the SIMD state. */
+#define CPU_FEATURE_SSE2			(1 << 0)
+#define CPU_FEATURE_SSE3			(1 << 1)
+#define CPU_FEATURE_SSSE3			(1 << 2)
+#define CPU_FEATURE_SSE4_1			(1 << 3)
+#define CPU_FEATURE_SSE4_2			(1 << 4)
+#define CPU_FEATURE_POPCNT			(1 << 5)
+#define CPU_FEATURE_AVX				(1 << 6)
+#define CPU_FEATURE_AVX2			(1 << 7)
+#define CPU_FEATURE_BMI2			(1 << 8)
+#define CPU_FEATURE_ERMS			(1 << 9)		/* Enhanced rep movsb/stosb */
+#define CPU_FEATURE_FSRM			(1 << 10)		/* Fast short rep movsb */
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+uint32_t cpu_features(void);
+const char *cpu_feature_name(unsigned int bit);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+static inline bool cpu_has(uint32_t features) {
+	return (cpu_features() & features) == features;
+}
+
+#endif
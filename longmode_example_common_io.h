@@ -0,0 +1,131 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_COMMON_IO_H__
+#define __LONGMODE_EXAMPLE_COMMON_IO_H__
+
+#include <stdint.h>
+
+#define CPUID_FEATURES			0x00000001
+#define CPUID_EDX_PAT			(1 << 16)
+#define CPUID_EXT_FEATURES		0x80000001
+#define CPUID_EXT_EDX_PDPE1GB	(1 << 26)
+
+static inline uint8_t port_in(unsigned int address) {
+	uint8_t value;
+	__asm__ __volatile__("inb (%%dx), %%al" : "=a"(value) : "d"(address));
+	return value;
+}
+
+static inline uint16_t port_in_word(unsigned int address) {
+	uint16_t value;
+	__asm__ __volatile__("inw (%%dx), %%ax" : "=a"(value) : "d"(address));
+	return value;
+}
+
+static inline uint32_t port_in_dword(unsigned int address) {
+	uint32_t value;
+	__asm__ __volatile__("inl (%%dx), %%eax" : "=a"(value) : "d"(address));
+	return value;
+}
+
+static inline void port_in_words(unsigned int address, void *target, unsigned int count) {
+	__asm__ __volatile__("rep insw" : "+D"(target), "+c"(count) : "d"(address) : "memory");
+}
+
+static inline void port_in_dwords(unsigned int address, void *target, unsigned int count) {
+	__asm__ __volatile__("rep insl" : "+D"(target), "+c"(count) : "d"(address) : "memory");
+}
+
+static inline void port_out(unsigned int address, uint8_t value) {
+	__asm__ __volatile__("outb %%al, %%dx" : :  "d"(address), "a"(value));
+}
+
+static inline void port_out_word(unsigned int address, uint16_t value) {
+	__asm__ __volatile__("outw %%ax, %%dx" : :  "d"(address), "a"(value));
+}
+
+static inline void port_out_dword(unsigned int address, uint32_t value) {
+	__asm__ __volatile__("outl %%eax, %%dx" : :  "d"(address), "a"(value));
+}
+
+static inline uint32_t mmio_read32(volatile void *base, unsigned int offset) {
+	return *(volatile uint32_t*)((volatile uint8_t*)base + offset);
+}
+
+static inline void mmio_write32(volatile void *base, unsigned int offset, uint32_t value) {
+	*(volatile uint32_t*)((volatile uint8_t*)base + offset) = value;
+}
+
+static inline uint64_t rdtsc(void) {
+	uint32_t low, high;
+	__asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+
+struct cpuid_t {
+	uint32_t eax, ebx, ecx, edx;
+};
+
+static inline struct cpuid_t cpuid(uint32_t leaf, uint32_t subleaf) {
+	struct cpuid_t result;
+	__asm__ __volatile__("cpuid" : "=a"(result.eax), "=b"(result.ebx), "=c"(result.ecx), "=d"(result.edx) : "a"(leaf), "c"(subleaf));
+	return result;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+	uint32_t low, high;
+	__asm__ __volatile__("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+	return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+	__asm__ __volatile__("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline uint64_t xgetbv(uint32_t xcr) {
+	uint32_t low, high;
+	__asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(xcr));
+	return ((uint64_t)high << 32) | low;
+}
+
+static inline void invlpg(const volatile void *address) {
+	__asm__ __volatile__("invlpg (%0)" : : "r"(address) : "memory");
+}
+
+static inline void wbinvd(void) {
+	__asm__ __volatile__("wbinvd" : : : "memory");
+}
+
+static inline void cpu_relax(void) {
+	__asm__ __volatile__("pause" : : : "memory");
+}
+
+/* GCC assumes that nothing lives in the first page and warns about any
+ * access there, hide the constant address from it */
+static inline const volatile void *low_memory(uintptr_t address) {
+	__asm__("" : "+r"(address));
+	return (const volatile void*)address;
+}
+
+#endif
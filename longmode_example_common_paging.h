@@ -0,0 +1,57 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_COMMON_PAGING_H__
+#define __LONGMODE_EXAMPLE_COMMON_PAGING_H__
+
+#include <stdint.h>
+
+#define PG_PRESENT				(1 << 0)
+#define PG_ALLOW_WRITE			(1 << 1)
+#define PG_WRITE_THROUGH		(1 << 3)
+#define PG_CACHE_DISABLE		(1 << 4)
+#define PG_PS					(1 << 7)		/* In page directory (pointer) entries */
+#define PG_PAT_4K				(1 << 7)		/* In page table entries */
+#define PG_TABLE				(PG_PRESENT | PG_ALLOW_WRITE)
+
+#define IA32_PAT				0x277
+#define PAT_TYPE_UC				0x00
+#define PAT_TYPE_WC				0x01
+#define PAT_TYPE_WT				0x04
+#define PAT_TYPE_WB				0x06
+#define PAT_TYPE_UC_MINUS		0x07
+
+/* The power-on PAT layout, except that entry 1 is write-combining and
+ * write-through moves from entry 1 to entry 5. Entries 0 and 3 (write-back
+ * and uncached) stay where CPUs without PAT support have them. */
+#define PAT_LAYOUT				(((uint64_t)PAT_TYPE_WB << 0) | ((uint64_t)PAT_TYPE_WC << 8) | ((uint64_t)PAT_TYPE_UC_MINUS << 16) | ((uint64_t)PAT_TYPE_UC << 24) | \
+								((uint64_t)PAT_TYPE_WB << 32) | ((uint64_t)PAT_TYPE_WT << 40) | ((uint64_t)PAT_TYPE_UC_MINUS << 48) | ((uint64_t)PAT_TYPE_UC << 56))
+
+/* Page table entry bits that select a memory type with PAT_LAYOUT */
+#define PG_CACHE_WB				0
+#define PG_CACHE_WC				PG_WRITE_THROUGH
+#define PG_CACHE_UC				(PG_WRITE_THROUGH | PG_CACHE_DISABLE)
+#define PG_CACHE_WT_4K			(PG_PAT_4K | PG_WRITE_THROUGH)
+#define PG_CACHE_MASK_4K		(PG_PAT_4K | PG_CACHE_DISABLE | PG_WRITE_THROUGH)
+
+#endif
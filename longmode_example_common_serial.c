@@ -0,0 +1,155 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_common_serial.h"
+#include "longmode_example_common_io.h"
+
+#define UART_THR				0		/* Transmit holding register (write) */
+#define UART_DLL				0		/* Divisor latch, low byte (DLAB = 1) */
+#define UART_IER				1		/* Interrupt enable register */
+#define UART_DLM				1		/* Divisor latch, high byte (DLAB = 1) */
+#define UART_IIR				2		/* Interrupt identification register (read) */
+#define UART_FCR				2		/* FIFO control register (write) */
+#define UART_LCR				3		/* Line control register */
+#define UART_MCR				4		/* Modem control register */
+#define UART_LSR				5		/* Line status register */
+#define UART_SCR				7		/* Scratch register */
+
+#define UART_LCR_8N1			0x03
+#define UART_LCR_DLAB			(1 << 7)
+#define UART_FCR_ENABLE			(1 << 0)
+#define UART_FCR_CLEAR_RX		(1 << 1)
+#define UART_FCR_CLEAR_TX		(1 << 2)
+#define UART_IIR_FIFO_MASK		0xc0		/* Both bits set: 16550A with working FIFOs */
+#define UART_MCR_DTR			(1 << 0)
+#define UART_MCR_RTS			(1 << 1)
+#define UART_MCR_OUT2			(1 << 3)
+#define UART_LSR_THRE			(1 << 5)	/* THR and, with FIFOs enabled, the TX FIFO empty */
+
+#define UART_CLOCK_HZ			115200		/* Input clock divided by 16 */
+#define UART_16550A_FIFO_DEPTH	16
+
+static struct serial_ring_t *serial_ring;
+static bool serial_draining;
+
+/* A missing UART reads back all ones, so the scratch register is used to
+ * check that one is present before anything is queued for it */
+static bool serial_probe(uint16_t port) {
+	port_out(port + UART_SCR, 0xa5);
+	if (port_in(port + UART_SCR) != 0xa5) {
+		return false;
+	}
+	port_out(port + UART_SCR, 0x5a);
+	return port_in(port + UART_SCR) == 0x5a;
+}
+
+/* Program COM1 for 8N1 without interrupts and set up the output ring;
+ * called by stage 1, stage 2 uses serial_attach() */
+bool serial_init(void) {
+	const uint16_t port = SERIAL_COM1_PORT;
+	if (!serial_probe(port)) {
+		return false;
+	}
+
+	const uint16_t divisor = UART_CLOCK_HZ / SERIAL_BAUDRATE;
+	port_out(port + UART_IER, 0);
+	port_out(port + UART_LCR, UART_LCR_DLAB);
+	port_out(port + UART_DLL, (divisor >> 0) & 0xff);
+	port_out(port + UART_DLM, (divisor >> 8) & 0xff);
+	port_out(port + UART_LCR, UART_LCR_8N1);
+	port_out(port + UART_FCR, UART_FCR_ENABLE | UART_FCR_CLEAR_RX | UART_FCR_CLEAR_TX);
+	port_out(port + UART_MCR, UART_MCR_DTR | UART_MCR_RTS | UART_MCR_OUT2);
+
+	struct serial_ring_t *ring = (struct serial_ring_t*)SERIAL_RING_ADDR;
+	ring->magic = SERIAL_RING_MAGIC;
+	ring->capacity = SERIAL_RING_CAPACITY;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->port = port;
+	ring->fifo_depth = ((port_in(port + UART_IIR) & UART_IIR_FIFO_MASK) == UART_IIR_FIFO_MASK) ? UART_16550A_FIFO_DEPTH : 1;
+	serial_ring = ring;
+	return true;
+}
+
+/* Continue with the ring (and the output still queued in it) that an
+ * earlier stage set up */
+bool serial_attach(void *ring) {
+	struct serial_ring_t *candidate = ring;
+	if (!candidate || (candidate->magic != SERIAL_RING_MAGIC)) {
+		return false;
+	}
+	serial_ring = candidate;
+	return true;
+}
+
+void *serial_ring_address(void) {
+	return serial_ring;
+}
+
+/* If the transmitter is idle, refill its FIFO in one go. Never waits, so it
+ * is called after every queued character and from the timer interrupt; the
+ * flag keeps an interrupt from draining the same bytes a second time. */
+void serial_poll(void) {
+	struct serial_ring_t *ring = serial_ring;
+	if (!ring || (ring->head == ring->tail)) {
+		return;
+	}
+	if (__atomic_test_and_set(&serial_draining, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	if (port_in(ring->port + UART_LSR) & UART_LSR_THRE) {
+		uint32_t tail = ring->tail;
+		const uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		for (unsigned int i = 0; (i < ring->fifo_depth) && (tail != head); i++) {
+			port_out(ring->port + UART_THR, ring->data[tail & (ring->capacity - 1)]);
+			tail++;
+		}
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+	__atomic_clear(&serial_draining, __ATOMIC_RELEASE);
+}
+
+/* Wait until everything queued has been handed to the UART */
+void serial_flush(void) {
+	while (serial_ring && (__atomic_load_n(&serial_ring->tail, __ATOMIC_ACQUIRE) != serial_ring->head)) {
+		serial_poll();
+		cpu_relax();
+	}
+}
+
+void serial_putc(char c) {
+	struct serial_ring_t *ring = serial_ring;
+	if (!ring) {
+		return;
+	}
+	/* Only a full ring makes the console wait for the UART */
+	while (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->capacity) {
+		serial_poll();
+		cpu_relax();
+	}
+	ring->data[ring->head & (ring->capacity - 1)] = c;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+	serial_poll();
+}
@@ -0,0 +1,62 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_COMMON_SERIAL_H__
+#define __LONGMODE_EXAMPLE_COMMON_SERIAL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SERIAL_COM1_PORT			0x3f8
+#define SERIAL_BAUDRATE				115200
+
+/* Physical location of the output ring; like the trace ring it stays
+ * below BOOTINFO_LOADER_END and is taken over by stage 2 */
+#define SERIAL_RING_ADDR			0x30000
+#define SERIAL_RING_CAPACITY		0x8000			/* Bytes of data, power of two */
+
+#define SERIAL_RING_MAGIC			0x474e5253		/* "SRNG" */
+
+/* Single producer (the console), drained by whoever finds the transmitter
+ * empty; head and tail run freely and are reduced modulo the capacity */
+struct serial_ring_t {
+	uint32_t magic;
+	uint32_t capacity;
+	uint32_t head;
+	uint32_t tail;
+	uint16_t port;
+	uint16_t fifo_depth;			/* Bytes that may be written once THR is empty */
+	uint32_t reserved[3];
+	uint8_t data[];
+};
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+bool serial_init(void);
+bool serial_attach(void *ring);
+void *serial_ring_address(void);
+void serial_poll(void);
+void serial_flush(void);
+void serial_putc(char c);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
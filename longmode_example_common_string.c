@@ -0,0 +1,236 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "longmode_example_common_string.h"
+#include "longmode_example_common_cpu.h"
+
+/* GCC emits calls to memcpy(), memmove(), memset() and strlen() for struct
+ * copies, initializers and loops it recognizes, so both stages need them.
+ * None of these is written as a loop over the data: GCC would turn such a
+ * loop back into a call of the very function it is in. Nothing saves the
+ * XMM registers on interrupts, so the SSE2 kernels below must not be reached
+ * from an interrupt handler (none copies or fills memory). */
+
+/* Up to this many bytes are moved with a few overlapping loads and stores
+ * instead of paying for the startup cost of a string instruction */
+#define STRING_SMALL_LIMIT			32
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_u64_t;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_u32_t;
+typedef uint16_t __attribute__((may_alias, aligned(1))) unaligned_u16_t;
+
+/* All loads happen before the first store, so this is also correct for
+ * overlapping buffers */
+static void copy_small(uint8_t *dst, const uint8_t *src, size_t length) {
+	if (length >= 16) {
+		const uint64_t a = *(const unaligned_u64_t*)(src + 0);
+		const uint64_t b = *(const unaligned_u64_t*)(src + 8);
+		const uint64_t c = *(const unaligned_u64_t*)(src + length - 16);
+		const uint64_t d = *(const unaligned_u64_t*)(src + length - 8);
+		*(unaligned_u64_t*)(dst + 0) = a;
+		*(unaligned_u64_t*)(dst + 8) = b;
+		*(unaligned_u64_t*)(dst + length - 16) = c;
+		*(unaligned_u64_t*)(dst + length - 8) = d;
+	} else if (length >= 8) {
+		const uint64_t a = *(const unaligned_u64_t*)src;
+		const uint64_t b = *(const unaligned_u64_t*)(src + length - 8);
+		*(unaligned_u64_t*)dst = a;
+		*(unaligned_u64_t*)(dst + length - 8) = b;
+	} else if (length >= 4) {
+		const uint32_t a = *(const unaligned_u32_t*)src;
+		const uint32_t b = *(const unaligned_u32_t*)(src + length - 4);
+		*(unaligned_u32_t*)dst = a;
+		*(unaligned_u32_t*)(dst + length - 4) = b;
+	} else if (length >= 2) {
+		const uint16_t a = *(const unaligned_u16_t*)src;
+		const uint16_t b = *(const unaligned_u16_t*)(src + length - 2);
+		*(unaligned_u16_t*)dst = a;
+		*(unaligned_u16_t*)(dst + length - 2) = b;
+	} else if (length) {
+		*dst = *src;
+	}
+}
+
+/* Moves 64 byte blocks with unaligned SSE2 loads and stores, at least one
+ * block, and the last 64 bytes from registers loaded upfront. Each block is
+ * loaded before it is stored, so dst below an overlapping src is fine. */
+static void __attribute__ ((target ("sse2"))) copy_forward_sse2(uint8_t *dst, const uint8_t *src, size_t length) {
+	uint8_t *tail_dst = dst + length - 64;
+	const uint8_t *tail_src = src + length - 64;
+	size_t blocks = length / 64;
+	__asm__ __volatile__(
+		"movdqu 0(%3), %%xmm4"			"\n\t"
+		"movdqu 16(%3), %%xmm5"			"\n\t"
+		"movdqu 32(%3), %%xmm6"			"\n\t"
+		"movdqu 48(%3), %%xmm7"			"\n\t"
+		"1:"							"\n\t"
+		"movdqu 0(%1), %%xmm0"			"\n\t"
+		"movdqu 16(%1), %%xmm1"			"\n\t"
+		"movdqu 32(%1), %%xmm2"			"\n\t"
+		"movdqu 48(%1), %%xmm3"			"\n\t"
+		"movdqu %%xmm0, 0(%0)"			"\n\t"
+		"movdqu %%xmm1, 16(%0)"			"\n\t"
+		"movdqu %%xmm2, 32(%0)"			"\n\t"
+		"movdqu %%xmm3, 48(%0)"			"\n\t"
+		"add $64, %0"					"\n\t"
+		"add $64, %1"					"\n\t"
+		"dec %2"						"\n\t"
+		"jnz 1b"						"\n\t"
+		"movdqu %%xmm4, 0(%4)"			"\n\t"
+		"movdqu %%xmm5, 16(%4)"			"\n\t"
+		"movdqu %%xmm6, 32(%4)"			"\n\t"
+		"movdqu %%xmm7, 48(%4)"
+		: "+r"(dst), "+r"(src), "+r"(blocks) : "r"(tail_src), "r"(tail_dst)
+		: "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "memory", "cc");
+}
+
+/* Stores 64 byte blocks of the pattern, at least one, and then the last 64
+ * bytes, overlapping the final block */
+static void __attribute__ ((target ("sse2"))) fill_sse2(uint8_t *dst, uint64_t pattern, size_t length) {
+	uint8_t *tail_dst = dst + length - 64;
+	size_t blocks = length / 64;
+	__asm__ __volatile__(
+		"movq %3, %%xmm0"				"\n\t"
+		"punpcklqdq %%xmm0, %%xmm0"		"\n\t"
+		"1:"							"\n\t"
+		"movdqu %%xmm0, 0(%0)"			"\n\t"
+		"movdqu %%xmm0, 16(%0)"			"\n\t"
+		"movdqu %%xmm0, 32(%0)"			"\n\t"
+		"movdqu %%xmm0, 48(%0)"			"\n\t"
+		"add $64, %0"					"\n\t"
+		"dec %1"						"\n\t"
+		"jnz 1b"						"\n\t"
+		"movdqu %%xmm0, 0(%2)"			"\n\t"
+		"movdqu %%xmm0, 16(%2)"			"\n\t"
+		"movdqu %%xmm0, 32(%2)"			"\n\t"
+		"movdqu %%xmm0, 48(%2)"
+		: "+r"(dst), "+r"(blocks) : "r"(tail_dst), "r"(pattern) : "xmm0", "memory", "cc");
+}
+
+/* Ascending copy, also correct for overlapping buffers when dst is below
+ * src. With enhanced rep movsb (ERMS) the byte granular string instruction
+ * is as fast as the qword one for any length and alignment. Without it,
+ * SSE2 moves 64 bytes per iteration; the qword fallback stores the last,
+ * possibly partial qword from a value loaded upfront. */
+static void copy_forward(uint8_t *dst, const uint8_t *src, size_t length) {
+	if (cpu_has(CPU_FEATURE_ERMS)) {
+		__asm__ __volatile__("rep movsb" : "+D"(dst), "+S"(src), "+c"(length) : : "memory");
+		return;
+	}
+	if ((length >= 64) && cpu_has(CPU_FEATURE_SSE2)) {
+		copy_forward_sse2(dst, src, length);
+		return;
+	}
+	const uint64_t tail = *(const unaligned_u64_t*)(src + length - 8);
+	uint8_t *tail_dst = dst + length - 8;
+	size_t qwords = length / 8;
+	__asm__ __volatile__("rep movsq" : "+D"(dst), "+S"(src), "+c"(qwords) : : "memory");
+	*(unaligned_u64_t*)tail_dst = tail;
+}
+
+/* Descending copy for dst above an overlapping src, qwords from the end
+ * down and the first, possibly partial qword from a value loaded upfront */
+static void copy_backward(uint8_t *dst, const uint8_t *src, size_t length) {
+	const uint64_t head = *(const unaligned_u64_t*)src;
+	uint8_t *head_dst = dst;
+	size_t qwords = length / 8;
+	dst += length - 8;
+	src += length - 8;
+	__asm__ __volatile__("std; rep movsq; cld" : "+D"(dst), "+S"(src), "+c"(qwords) : : "memory");
+	*(unaligned_u64_t*)head_dst = head;
+}
+
+void *memcpy(void *restrict dst, const void *restrict src, size_t length) {
+	if (length <= STRING_SMALL_LIMIT) {
+		copy_small(dst, src, length);
+	} else {
+		copy_forward(dst, src, length);
+	}
+	return dst;
+}
+
+void *memmove(void *dst, const void *src, size_t length) {
+	if (length <= STRING_SMALL_LIMIT) {
+		copy_small(dst, src, length);
+	} else if (((uintptr_t)dst - (uintptr_t)src) >= length) {
+		/* dst is below src or the buffers do not overlap */
+		copy_forward(dst, src, length);
+	} else {
+		copy_backward(dst, src, length);
+	}
+	return dst;
+}
+
+void *memset(void *dst, int value, size_t length) {
+	uint8_t *bytes = dst;
+	const uint64_t pattern = 0x0101010101010101ULL * (uint8_t)value;
+	if (length >= STRING_SMALL_LIMIT) {
+		if (cpu_has(CPU_FEATURE_ERMS)) {
+			__asm__ __volatile__("rep stosb" : "+D"(bytes), "+c"(length) : "a"(value) : "memory");
+		} else if ((length >= 64) && cpu_has(CPU_FEATURE_SSE2)) {
+			fill_sse2(bytes, pattern, length);
+		} else {
+			*(unaligned_u64_t*)(bytes + length - 8) = pattern;
+			size_t qwords = length / 8;
+			__asm__ __volatile__("rep stosq" : "+D"(bytes), "+c"(qwords) : "a"(pattern) : "memory");
+		}
+	} else if (length >= 16) {
+		*(unaligned_u64_t*)(bytes + 0) = pattern;
+		*(unaligned_u64_t*)(bytes + 8) = pattern;
+		*(unaligned_u64_t*)(bytes + length - 16) = pattern;
+		*(unaligned_u64_t*)(bytes + length - 8) = pattern;
+	} else if (length >= 8) {
+		*(unaligned_u64_t*)bytes = pattern;
+		*(unaligned_u64_t*)(bytes + length - 8) = pattern;
+	} else if (length >= 4) {
+		*(unaligned_u32_t*)bytes = pattern;
+		*(unaligned_u32_t*)(bytes + length - 4) = pattern;
+	} else if (length >= 2) {
+		*(unaligned_u16_t*)bytes = pattern;
+		*(unaligned_u16_t*)(bytes + length - 2) = pattern;
+	} else if (length) {
+		*bytes = pattern;
+	}
+	return dst;
+}
+
+/* repe cmpsb stops after the first difference, both pointers one past it */
+int memcmp(const void *a, const void *b, size_t length) {
+	if (length == 0) {
+		return 0;
+	}
+	const uint8_t *a_bytes = a;
+	const uint8_t *b_bytes = b;
+	bool equal;
+	__asm__ ("repe cmpsb" : "=@ccz"(equal), "+S"(a_bytes), "+D"(b_bytes), "+c"(length) : "m"(*(const uint8_t (*)[])a), "m"(*(const uint8_t (*)[])b));
+	return equal ? 0 : (a_bytes[-1] - b_bytes[-1]);
+}
+
+size_t strlen(const char *string) {
+	size_t remaining = ~(size_t)0;
+	__asm__ ("repne scasb" : "+D"(string), "+c"(remaining) : "a"(0), "m"(*(const char (*)[])string));
+	return ~remaining - 1;
+}
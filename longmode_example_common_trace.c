@@ -0,0 +1,146 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_common_trace.h"
+#include "longmode_example_common_io.h"
+#include "longmode_example_common_serial.h"
+#include "longmode_example_common_console.h"
+
+static struct trace_buffer_t *trace_buffer;
+
+static const char *trace_event_names[TRACE_EVENT_COUNT] = {
+	[TRACE_STAGE0_MAIN] = "stage0_main",
+	[TRACE_STAGE0_PMODE] = "stage0_pmode",
+	[TRACE_STAGE1_MAIN32] = "stage1_main32",
+	[TRACE_STAGE1_MAIN64] = "stage1_main64",
+	[TRACE_STAGE1_LOAD_STAGE2] = "stage1_load_stage2",
+	[TRACE_STAGE1_ENTER_STAGE2] = "stage1_enter_stage2",
+	[TRACE_STAGE2_MAIN] = "stage2_main",
+	[TRACE_STAGE2_INITIALIZED] = "stage2_initialized",
+	[TRACE_ATA_COMMAND] = "ata_command",
+	[TRACE_ATA_DONE] = "ata_done",
+};
+
+static void trace_record(uint64_t tsc, enum trace_event_t event, uint32_t arg) {
+	if (!trace_buffer) {
+		return;
+	}
+	const uint32_t index = __atomic_fetch_add(&trace_buffer->head, 1, __ATOMIC_RELAXED) % trace_buffer->capacity;
+	trace_buffer->entry[index] = (struct trace_entry_t){
+		.tsc = tsc,
+		.event = event,
+		.arg = arg,
+	};
+}
+
+/* Stage 0 and main32 leave plain TSC values behind; anything that is not in
+ * the past was not written in this boot */
+static void trace_import_early(uint64_t address, enum trace_event_t event) {
+	const uint64_t tsc = *(const volatile uint64_t*)low_memory(address);
+	if ((tsc != 0) && (tsc <= rdtsc())) {
+		trace_record(tsc, event, 0);
+	}
+}
+
+/* Called by stage 1 while low memory is still identity mapped */
+void trace_init(void) {
+	trace_buffer = (struct trace_buffer_t*)TRACE_BUFFER_ADDR;
+	trace_buffer->magic = TRACE_MAGIC;
+	trace_buffer->capacity = (TRACE_BUFFER_SIZE - sizeof(struct trace_buffer_t)) / sizeof(struct trace_entry_t);
+	trace_buffer->head = 0;
+	trace_import_early(TRACE_EARLY_STAGE0_MAIN_ADDR, TRACE_STAGE0_MAIN);
+	trace_import_early(TRACE_EARLY_STAGE0_PMODE_ADDR, TRACE_STAGE0_PMODE);
+	trace_import_early(TRACE_EARLY_STAGE1_MAIN32_ADDR, TRACE_STAGE1_MAIN32);
+}
+
+/* Continue a ring that an earlier stage created */
+bool trace_attach(void *buffer) {
+	struct trace_buffer_t *candidate = buffer;
+	if (!candidate || (candidate->magic != TRACE_MAGIC)) {
+		return false;
+	}
+	trace_buffer = candidate;
+	return true;
+}
+
+void *trace_buffer_address(void) {
+	return trace_buffer;
+}
+
+void trace_event(enum trace_event_t event, uint32_t arg) {
+	trace_record(rdtsc(), event, arg);
+}
+
+static void trace_putc(char c) {
+	port_out(TRACE_DEBUGCON_PORT, c);
+	serial_putc(c);
+}
+
+static void trace_puts(const char *string) {
+	while (*string) {
+		trace_putc(*string++);
+	}
+}
+
+static void trace_put_hex(uint64_t value, unsigned int digits) {
+	char buffer[17];
+	format_hex(buffer, value, digits);
+	trace_puts(buffer);
+}
+
+static void trace_put_decimal(uint64_t value) {
+	char buffer[21];
+	buffer[20] = 0;
+	trace_puts(format_unsigned(buffer + 20, value, 10, false));
+}
+
+/* Write all retained events as text lines to the QEMU debugcon port and
+ * queue them for COM1; the build script's --trace option parses this */
+void trace_dump(uint64_t tsc_hz) {
+	if (!trace_buffer) {
+		return;
+	}
+	const uint32_t head = __atomic_load_n(&trace_buffer->head, __ATOMIC_ACQUIRE);
+	const uint32_t count = (head < trace_buffer->capacity) ? head : trace_buffer->capacity;
+
+	trace_puts("trace: begin tsc_hz=");
+	trace_put_decimal(tsc_hz);
+	trace_puts(" events=");
+	trace_put_decimal(count);
+	trace_puts(" dropped=");
+	trace_put_decimal(head - count);
+	trace_puts("\n");
+	for (uint32_t i = head - count; i != head; i++) {
+		const struct trace_entry_t *entry = &trace_buffer->entry[i % trace_buffer->capacity];
+		trace_puts("trace: ");
+		trace_put_hex(entry->tsc, 16);
+		trace_puts(" ");
+		trace_puts((entry->event < TRACE_EVENT_COUNT) ? trace_event_names[entry->event] : "unknown");
+		trace_puts(" ");
+		trace_put_hex(entry->arg, 8);
+		trace_puts("\n");
+	}
+	trace_puts("trace: end\n");
+}
@@ -0,0 +1,83 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_COMMON_TRACE_H__
+#define __LONGMODE_EXAMPLE_COMMON_TRACE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Stage 0 and the 32 bit entry of stage 1 run before there is any C code
+ * and store raw TSC values in these slots (the addresses are repeated in
+ * the assembly code); stage 1 turns them into the first trace events */
+#define TRACE_EARLY_STAGE0_MAIN_ADDR	0xc00
+#define TRACE_EARLY_STAGE0_PMODE_ADDR	0xc08
+#define TRACE_EARLY_STAGE1_MAIN32_ADDR	0xc10
+
+/* Physical location of the ring; below BOOTINFO_LOADER_END, so stage 2
+ * never hands it out */
+#define TRACE_BUFFER_ADDR				0x20000
+#define TRACE_BUFFER_SIZE				0x10000
+
+#define TRACE_MAGIC						0x45435254		/* "TRCE" */
+#define TRACE_DEBUGCON_PORT				0xe9
+
+enum trace_event_t {
+	TRACE_STAGE0_MAIN,
+	TRACE_STAGE0_PMODE,
+	TRACE_STAGE1_MAIN32,
+	TRACE_STAGE1_MAIN64,
+	TRACE_STAGE1_LOAD_STAGE2,
+	TRACE_STAGE1_ENTER_STAGE2,
+	TRACE_STAGE2_MAIN,
+	TRACE_STAGE2_INITIALIZED,
+	TRACE_ATA_COMMAND,				/* arg: command << 24 | sector count */
+	TRACE_ATA_DONE,
+	TRACE_EVENT_COUNT
+};
+
+struct trace_entry_t {
+	uint64_t tsc;
+	uint32_t event;
+	uint32_t arg;
+};
+
+/* Once full, the oldest entries are overwritten; head counts all events
+ * ever recorded */
+struct trace_buffer_t {
+	uint32_t magic;
+	uint32_t capacity;
+	uint32_t head;
+	uint32_t reserved;
+	struct trace_entry_t entry[];
+};
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+void trace_init(void);
+bool trace_attach(void *buffer);
+void *trace_buffer_address(void);
+void trace_event(enum trace_event_t event, uint32_t arg);
+void trace_dump(uint64_t tsc_hz);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -0,0 +1,113 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_common_tsc.h"
+#include "longmode_example_common_io.h"
+
+#define PIT_INPUT_FREQUENCY_HZ	1193182
+#define PIT_CHANNEL2_DATA		0x42
+#define PIT_COMMAND				0x43
+#define PIT_COMMAND_CH2_MODE0	0xb0		/* Channel 2, lobyte/hibyte, interrupt on terminal count */
+
+#define PORT_B					0x61
+#define PORT_B_GATE2			(1 << 0)
+#define PORT_B_SPEAKER			(1 << 1)
+#define PORT_B_OUT2				(1 << 5)
+
+#define CALIBRATION_PIT_COUNTS	11932		/* 10 ms */
+#define CALIBRATION_ROUNDS		3
+
+static struct {
+	uint64_t hz;
+	uint64_t ns_per_tick_fixed;		/* Nanoseconds per TSC tick, 32.32 fixed point */
+} tsc;
+
+/* Count one PIT channel 2 period in TSC ticks. Channel 2 (the speaker
+ * channel, with the speaker itself disconnected) is not used by anything
+ * else and its output can be polled, so this works without interrupts. */
+static uint64_t tsc_ticks_per_pit_period(uint16_t count) {
+	const uint8_t port_b = port_in(PORT_B) & ~(PORT_B_GATE2 | PORT_B_SPEAKER);
+	port_out(PORT_B, port_b);
+	port_out(PIT_COMMAND, PIT_COMMAND_CH2_MODE0);
+	port_out(PIT_CHANNEL2_DATA, (count >> 0) & 0xff);
+	port_out(PIT_CHANNEL2_DATA, (count >> 8) & 0xff);
+
+	/* Raising the gate starts the count */
+	port_out(PORT_B, port_b | PORT_B_GATE2);
+	const uint64_t t_start = rdtsc();
+	while (!(port_in(PORT_B) & PORT_B_OUT2)) {
+		cpu_relax();
+	}
+	const uint64_t ticks = rdtsc() - t_start;
+	port_out(PORT_B, port_b);
+	return ticks;
+}
+
+void tsc_set_frequency(uint64_t hz) {
+	tsc.hz = hz;
+	tsc.ns_per_tick_fixed = hz ? (1000000000ULL << 32) / hz : 0;
+}
+
+/* Measure the TSC frequency against the PIT, keeping the shortest of a few
+ * rounds (a longer one was disturbed, e.g. by an SMI or the host) */
+uint64_t tsc_calibrate(void) {
+	uint64_t best_ticks = ~0ULL;
+	for (unsigned int i = 0; i < CALIBRATION_ROUNDS; i++) {
+		const uint64_t ticks = tsc_ticks_per_pit_period(CALIBRATION_PIT_COUNTS);
+		if (ticks < best_ticks) {
+			best_ticks = ticks;
+		}
+	}
+	tsc_set_frequency(best_ticks * PIT_INPUT_FREQUENCY_HZ / CALIBRATION_PIT_COUNTS);
+	return tsc.hz;
+}
+
+uint64_t tsc_frequency(void) {
+	return tsc.hz;
+}
+
+/* Monotonic time since the TSC was reset, 0 before calibration */
+uint64_t now_ns(void) {
+	return ((unsigned __int128)rdtsc() * tsc.ns_per_tick_fixed) >> 32;
+}
+
+uint64_t deadline_ns(uint64_t timeout_ns) {
+	return now_ns() + timeout_ns;
+}
+
+bool deadline_expired(uint64_t deadline) {
+	return now_ns() >= deadline;
+}
+
+void delay_ns(uint64_t nanoseconds) {
+	const uint64_t deadline = deadline_ns(nanoseconds);
+	while (!deadline_expired(deadline)) {
+		cpu_relax();
+	}
+}
+
+void delay_us(uint64_t microseconds) {
+	delay_ns(microseconds * 1000);
+}
@@ -0,0 +1,41 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_COMMON_TSC_H__
+#define __LONGMODE_EXAMPLE_COMMON_TSC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+void tsc_set_frequency(uint64_t hz);
+uint64_t tsc_calibrate(void);
+uint64_t tsc_frequency(void);
+uint64_t now_ns(void);
+uint64_t deadline_ns(uint64_t timeout_ns);
+bool deadline_expired(uint64_t deadline);
+void delay_ns(uint64_t nanoseconds);
+void delay_us(uint64_t microseconds);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -0,0 +1,171 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_common_vgacon.h"
+#include "longmode_example_common_io.h"
+
+#define VGA_TEXT_BUFFER				0xb8000
+#define VGA_VRAM_LINES				(0x8000 / (2 * VGACON_COLUMNS))		/* 32 kiB of text memory */
+#define VGA_BLANK					0x0720
+
+#define CRTC_INDEX					0x3d4
+#define CRTC_DATA					0x3d5
+#define CRTC_START_ADDRESS_HIGH		0x0c
+#define CRTC_START_ADDRESS_LOW		0x0d
+#define CRTC_CURSOR_LOCATION_HIGH	0x0e
+#define CRTC_CURSOR_LOCATION_LOW	0x0f
+
+union vgacon_line_t {
+	uint16_t cell[VGACON_COLUMNS];
+	uint64_t qword[VGACON_COLUMNS / 4];
+};
+
+/* The visible screen is kept in RAM as a ring of lines, slot "top" holding
+ * screen row 0, and only lines changed since the last flush are copied to
+ * VRAM. Scrolling moves the CRTC start address down by one line, so lines
+ * that are already in VRAM stay where they are and scrolled out lines
+ * remain in VRAM above the visible area. */
+static struct {
+	union vgacon_line_t shadow[VGACON_ROWS];
+	bool dirty[VGACON_ROWS];
+	unsigned int top;
+	unsigned int start_line;		/* First VRAM line on screen */
+	bool start_changed;
+	unsigned int x, y;
+} vgacon;
+
+static uint8_t crtc_read(uint8_t index) {
+	port_out(CRTC_INDEX, index);
+	return port_in(CRTC_DATA);
+}
+
+static void crtc_write(uint8_t index, uint8_t value) {
+	port_out(CRTC_INDEX, index);
+	port_out(CRTC_DATA, value);
+}
+
+static volatile union vgacon_line_t *vram_line(unsigned int line) {
+	return (volatile union vgacon_line_t*)VGA_TEXT_BUFFER + line;
+}
+
+static unsigned int vgacon_slot(unsigned int row) {
+	return (vgacon.top + row) % VGACON_ROWS;
+}
+
+/* Take over the screen as the previous stage left it: the start address
+ * and the cursor position are read back from the CRTC and the visible lines
+ * from VRAM, which happens only once */
+void vgacon_init(void) {
+	const unsigned int start = (crtc_read(CRTC_START_ADDRESS_HIGH) << 8) | crtc_read(CRTC_START_ADDRESS_LOW);
+	const unsigned int cursor = (crtc_read(CRTC_CURSOR_LOCATION_HIGH) << 8) | crtc_read(CRTC_CURSOR_LOCATION_LOW);
+	vgacon.top = 0;
+	vgacon.start_line = start / VGACON_COLUMNS;
+	vgacon.start_changed = false;
+	if (((start % VGACON_COLUMNS) != 0) || (vgacon.start_line + VGACON_ROWS > VGA_VRAM_LINES)) {
+		vgacon.start_line = 0;
+		vgacon.start_changed = true;
+	}
+	for (unsigned int row = 0; row < VGACON_ROWS; row++) {
+		for (unsigned int i = 0; i < VGACON_COLUMNS / 4; i++) {
+			vgacon.shadow[row].qword[i] = vram_line(vgacon.start_line + row)->qword[i];
+		}
+		vgacon.dirty[row] = vgacon.start_changed;
+	}
+
+	const unsigned int cursor_offset = cursor - (vgacon.start_line * VGACON_COLUMNS);
+	if ((cursor >= vgacon.start_line * VGACON_COLUMNS) && (cursor_offset < VGACON_ROWS * VGACON_COLUMNS)) {
+		vgacon.x = cursor_offset % VGACON_COLUMNS;
+		vgacon.y = cursor_offset / VGACON_COLUMNS;
+	} else {
+		vgacon.x = 0;
+		vgacon.y = 0;
+	}
+}
+
+void vgacon_set_line(unsigned int y) {
+	vgacon.x = 0;
+	vgacon.y = (y < VGACON_ROWS) ? y : (VGACON_ROWS - 1);
+}
+
+void vgacon_newline(void) {
+	vgacon.x = 0;
+	if (vgacon.y + 1 < VGACON_ROWS) {
+		vgacon.y++;
+		return;
+	}
+
+	/* Scroll: the top line becomes the new, blank bottom line */
+	const unsigned int slot = vgacon_slot(0);
+	for (unsigned int i = 0; i < VGACON_COLUMNS; i++) {
+		vgacon.shadow[slot].cell[i] = VGA_BLANK;
+	}
+	vgacon.dirty[slot] = true;
+	vgacon.top = (vgacon.top + 1) % VGACON_ROWS;
+	vgacon.start_line++;
+	vgacon.start_changed = true;
+	if (vgacon.start_line + VGACON_ROWS > VGA_VRAM_LINES) {
+		/* End of VRAM, continue at its start and redraw everything */
+		vgacon.start_line = 0;
+		for (unsigned int row = 0; row < VGACON_ROWS; row++) {
+			vgacon.dirty[row] = true;
+		}
+	}
+}
+
+void vgacon_putc(uint8_t color, uint8_t character) {
+	const unsigned int slot = vgacon_slot(vgacon.y);
+	vgacon.shadow[slot].cell[vgacon.x] = (color << 8) | character;
+	vgacon.dirty[slot] = true;
+	vgacon.x++;
+	if (vgacon.x == VGACON_COLUMNS) {
+		vgacon_newline();
+	}
+}
+
+/* Copy the changed lines to VRAM, then move the start address and the
+ * hardware cursor */
+void vgacon_flush(void) {
+	for (unsigned int row = 0; row < VGACON_ROWS; row++) {
+		const unsigned int slot = vgacon_slot(row);
+		if (!vgacon.dirty[slot]) {
+			continue;
+		}
+		volatile union vgacon_line_t *line = vram_line(vgacon.start_line + row);
+		for (unsigned int i = 0; i < VGACON_COLUMNS / 4; i++) {
+			line->qword[i] = vgacon.shadow[slot].qword[i];
+		}
+		vgacon.dirty[slot] = false;
+	}
+
+	const unsigned int start = vgacon.start_line * VGACON_COLUMNS;
+	if (vgacon.start_changed) {
+		crtc_write(CRTC_START_ADDRESS_HIGH, (start >> 8) & 0xff);
+		crtc_write(CRTC_START_ADDRESS_LOW, (start >> 0) & 0xff);
+		vgacon.start_changed = false;
+	}
+	const unsigned int cursor = start + (vgacon.y * VGACON_COLUMNS) + vgacon.x;
+	crtc_write(CRTC_CURSOR_LOCATION_HIGH, (cursor >> 8) & 0xff);
+	crtc_write(CRTC_CURSOR_LOCATION_LOW, (cursor >> 0) & 0xff);
+}
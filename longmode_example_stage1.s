@@ -53,6 +53,12 @@
 .equ PG_ALLOW_WRITE,		(1 << 1)
 .equ PG_PS,					(1 << 7)
 
+.include "longmode_example_common_simd.inc"
+
+.equ CR4_PAE,				(1 << 5)
+
+.equ TRACE_STAGE1_MAIN32,	0xc10			# Must match longmode_example_common_trace.h
+
 .code32
 
 .globl main
@@ -60,12 +66,19 @@ main:
 
 .globl main32
 main32:
+	# Boot trace timestamp, picked up by trace_init()
+	rdtsc
+	mov %eax, TRACE_STAGE1_MAIN32
+	mov %edx, TRACE_STAGE1_MAIN32 + 4
+
 	# 10.8.5 Initializing IA-32e Mode
 	# Right now, PE = 1, PG = 0, PAE = 0, LME = 0
 
+	enable_simd
+
 	# Step 2: Enable PAE
 	mov %cr4, %eax
-	or $0x20, %eax
+	or $CR4_PAE, %eax
 	mov %eax, %cr4
 
 	# Step 3: Load %cr3 with PML4
@@ -111,8 +124,6 @@ main32_to_64:
 ivt:
 	.long main32
 
-# Identity mapped first 2 MiB of memory
-# Map second 2 MiB chunk at linear 0x40000000 (1 GiB) to physical 0x2000000 (32 MiB) for stage 2
 gdt64:
 	gdt64_entry_null:	segment_descriptor 0, 0, 0
 	gdt64_entry_cs: 	segment_descriptor 0, 0xfffff, SD_SEGTYPE_CODE_RX | SD_P | SD_G | SD_L
@@ -123,6 +134,8 @@ gdt64_desc:
 	.word gdt64_end - gdt64 - 1		# size of GDT
 	.long gdt64						# offset of GDT
 
+# Identity mapped first 2 MiB of memory, just enough to get into long mode.
+# The C code replaces these with tables that map all of memory.
 .align 4096
 initial_pml4:
 	.quad (PG_PRESENT | PG_ALLOW_WRITE) + initial_pdptr
@@ -131,17 +144,11 @@ initial_pml4:
 .align 4096
 initial_pdptr:
 	.quad (PG_PRESENT | PG_ALLOW_WRITE) + initial_pdir
-	.quad (PG_PRESENT | PG_ALLOW_WRITE) + stage2_pdir
-	.skip 8 * 510
+	.skip 8 * 511
 
 .align 4096
 initial_pdir:
 	.quad PG_PRESENT | PG_ALLOW_WRITE | PG_PS
 	.skip 8 * 511
 
-.align 4096
-stage2_pdir:
-	.quad PG_PRESENT | PG_ALLOW_WRITE | PG_PS | (32 * 1024 * 1024)
-	.skip 8 * 511
-
 .section	.note.GNU-stack,"",@progbits
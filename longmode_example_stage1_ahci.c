@@ -0,0 +1,478 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage1_ahci.h"
+#include "longmode_example_stage1_blockdev.h"
+#include "longmode_example_common_io.h"
+#include "longmode_example_stage1_pci.h"
+#include "longmode_example_stage1_memory.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_string.h"
+#include "longmode_example_common_tsc.h"
+#include "longmode_example_common_trace.h"
+
+#define PCI_SATA_PROGIF_AHCI		0x01
+#define PCI_AHCI_ABAR				5
+
+/* HBA registers, relative to ABAR */
+#define AHCI_REG_CAP				0x00
+#define AHCI_REG_GHC				0x04
+#define AHCI_REG_PI					0x0c
+#define AHCI_CAP_SNCQ				(1 << 30)
+#define AHCI_GHC_AE					(1UL << 31)
+#define AHCI_MAX_PORTS				32
+#define AHCI_ABAR_SIZE				(0x100 + (0x80 * AHCI_MAX_PORTS))
+
+/* Port registers, relative to the port's register block */
+#define AHCI_PORT_BASE(port)		(0x100 + (0x80 * (port)))
+#define AHCI_PxCLB					0x00
+#define AHCI_PxCLBU					0x04
+#define AHCI_PxFB					0x08
+#define AHCI_PxFBU					0x0c
+#define AHCI_PxIS					0x10
+#define AHCI_PxIE					0x14
+#define AHCI_PxCMD					0x18
+#define AHCI_PxTFD					0x20
+#define AHCI_PxSIG					0x24
+#define AHCI_PxSSTS					0x28
+#define AHCI_PxSERR					0x30
+#define AHCI_PxSACT					0x34
+#define AHCI_PxCI					0x38
+
+#define AHCI_PxCMD_ST				(1 << 0)
+#define AHCI_PxCMD_FRE				(1 << 4)
+#define AHCI_PxCMD_FR				(1 << 14)
+#define AHCI_PxCMD_CR				(1 << 15)
+#define AHCI_PxIS_TFES				(1 << 30)
+#define AHCI_PxTFD_ERR				(1 << 0)
+#define AHCI_PxTFD_DRQ				(1 << 3)
+#define AHCI_PxTFD_BSY				(1 << 7)
+#define AHCI_PxSSTS_DET_MASK		0x0f
+#define AHCI_PxSSTS_DET_PRESENT		0x03
+#define AHCI_SIG_ATA				0x00000101
+
+#define AHCI_CMDHDR_CFL_H2D			(sizeof(struct fis_reg_h2d_t) / 4)
+#define AHCI_PRDT_ENTRIES			8
+#define AHCI_PRD_MAX_BYTES			(4 * 1024 * 1024)
+
+/* One command moves at most 65536 sectors (32 MiB), which is exactly what
+ * the PRDT of a command table can describe. With NCQ, reads are split into
+ * smaller commands so that several of them are outstanding at once. */
+#define AHCI_MAX_SECTORS_PER_CMD	65536
+#define AHCI_NCQ_SECTORS_PER_CMD	8192
+
+#define AHCI_PORT_TIMEOUT_MS		500		/* PxCMD.CR and PxCMD.FR must clear within 500 ms */
+#define AHCI_SPINUP_TIMEOUT_MS		10000	/* The drive may still be spinning up when the port starts */
+#define AHCI_COMMAND_TIMEOUT_MS		5000
+
+#define FIS_TYPE_REG_H2D			0x27
+#define FIS_FLAG_COMMAND			(1 << 7)
+#define FIS_DEVICE_LBA				(1 << 6)
+
+#define ATA_CMD_READ_DMA			0xc8
+#define ATA_CMD_READ_DMA_EXT		0x25
+#define ATA_CMD_READ_FPDMA_QUEUED	0x60
+#define ATA_CMD_IDENTIFY_DEVICE		0xec
+
+struct fis_reg_h2d_t {
+	uint8_t fis_type;
+	uint8_t flags;
+	uint8_t command;
+	uint8_t feature_low;
+	uint8_t lba0, lba1, lba2;
+	uint8_t device;
+	uint8_t lba3, lba4, lba5;
+	uint8_t feature_high;
+	uint8_t count_low, count_high;
+	uint8_t icc;
+	uint8_t control;
+	uint8_t reserved[4];
+} __attribute__ ((packed));
+
+_Static_assert(sizeof(struct fis_reg_h2d_t) == 20, "H2D register FIS not 20 bytes long");
+
+struct ahci_command_header_t {
+	uint16_t flags;				/* Bits 4:0: FIS length in dwords */
+	uint16_t prdt_length;
+	uint32_t prd_byte_count;
+	uint64_t command_table_base;
+	uint32_t reserved[4];
+} __attribute__ ((packed));
+
+struct ahci_prdt_entry_t {
+	uint64_t data_base;
+	uint32_t reserved;
+	uint32_t byte_count;		/* Bits 21:0: byte count - 1 */
+} __attribute__ ((packed));
+
+struct ahci_command_table_t {
+	union {
+		struct fis_reg_h2d_t h2d;
+		uint8_t raw[64];
+	} command_fis;
+	uint8_t atapi_command[16];
+	uint8_t reserved[48];
+	struct ahci_prdt_entry_t prdt[AHCI_PRDT_ENTRIES];
+} __attribute__ ((packed));
+
+static struct {
+	volatile uint8_t *abar;
+	volatile uint8_t *port;
+	unsigned int port_index;
+	unsigned int slot_count;
+	unsigned int queue_depth;		/* NCQ commands outstanding at once, 0 if NCQ is not used */
+	bool lba48;
+	uint64_t sector_count;
+	struct ahci_command_header_t *command_list;
+	struct ahci_command_table_t *command_tables;
+} ahci;
+
+/* The read that read_start() issued and read_wait() completes */
+static struct {
+	uint64_t lba;
+	uint32_t remaining_sectors;
+	void *target;
+	uint32_t outstanding;
+	unsigned int outstanding_count;
+} ahci_request;
+
+/* Wait until all bits in "mask" of a port register are clear */
+static bool ahci_wait_clear(unsigned int reg, uint32_t mask, unsigned int timeout_ms) {
+	const uint64_t deadline = deadline_ns(timeout_ms * 1000000ULL);
+	while (mmio_read32(ahci.port, reg) & mask) {
+		if (deadline_expired(deadline)) {
+			return false;
+		}
+		cpu_relax();
+	}
+	return true;
+}
+
+/* Also aborts whatever commands are still outstanding */
+static bool ahci_port_stop(void) {
+	mmio_write32(ahci.port, AHCI_PxCMD, mmio_read32(ahci.port, AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+	if (!ahci_wait_clear(AHCI_PxCMD, AHCI_PxCMD_CR, AHCI_PORT_TIMEOUT_MS)) {
+		return false;
+	}
+	mmio_write32(ahci.port, AHCI_PxCMD, mmio_read32(ahci.port, AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+	return ahci_wait_clear(AHCI_PxCMD, AHCI_PxCMD_FR, AHCI_PORT_TIMEOUT_MS);
+}
+
+static bool ahci_port_start(void) {
+	mmio_write32(ahci.port, AHCI_PxCMD, mmio_read32(ahci.port, AHCI_PxCMD) | AHCI_PxCMD_FRE);
+	if (!ahci_wait_clear(AHCI_PxTFD, AHCI_PxTFD_BSY | AHCI_PxTFD_DRQ, AHCI_SPINUP_TIMEOUT_MS)) {
+		return false;
+	}
+	mmio_write32(ahci.port, AHCI_PxCMD, mmio_read32(ahci.port, AHCI_PxCMD) | AHCI_PxCMD_ST);
+	return true;
+}
+
+static bool ahci_port_init(void) {
+	ahci.command_list = dma_alloc(32 * sizeof(struct ahci_command_header_t), 1024);
+	void *received_fis = dma_alloc(256, 256);
+	ahci.command_tables = dma_alloc(ahci.slot_count * sizeof(struct ahci_command_table_t), 128);
+	if (!ahci.command_list || !received_fis || !ahci.command_tables) {
+		return false;
+	}
+
+	if (!ahci_port_stop()) {
+		return false;
+	}
+	for (unsigned int slot = 0; slot < ahci.slot_count; slot++) {
+		ahci.command_list[slot].command_table_base = virt_to_phys(&ahci.command_tables[slot]);
+	}
+	mmio_write32(ahci.port, AHCI_PxCLB, virt_to_phys(ahci.command_list));
+	mmio_write32(ahci.port, AHCI_PxCLBU, virt_to_phys(ahci.command_list) >> 32);
+	mmio_write32(ahci.port, AHCI_PxFB, virt_to_phys(received_fis));
+	mmio_write32(ahci.port, AHCI_PxFBU, virt_to_phys(received_fis) >> 32);
+	mmio_write32(ahci.port, AHCI_PxIE, 0);
+	mmio_write32(ahci.port, AHCI_PxSERR, 0xffffffff);
+	mmio_write32(ahci.port, AHCI_PxIS, 0xffffffff);
+	return ahci_port_start();
+}
+
+/* Build the command FIS, PRDT and command header of one slot. For NCQ
+ * commands the sector count moves to the feature register and the count
+ * register carries the tag, which equals the slot number. */
+static void ahci_setup_command(unsigned int slot, uint8_t command, uint64_t lba, uint32_t sector_count, void *target, uint32_t length) {
+	struct ahci_command_table_t *table = &ahci.command_tables[slot];
+	struct fis_reg_h2d_t *fis = &table->command_fis.h2d;
+	memset(fis, 0, sizeof(*fis));
+	fis->fis_type = FIS_TYPE_REG_H2D;
+	fis->flags = FIS_FLAG_COMMAND;
+	fis->command = command;
+	fis->device = FIS_DEVICE_LBA;
+	if (command == ATA_CMD_READ_DMA) {
+		/* LBA28 commands take bits 27:24 from the device register */
+		fis->device |= (lba >> 24) & 0x0f;
+	}
+	fis->lba0 = lba >> 0;
+	fis->lba1 = lba >> 8;
+	fis->lba2 = lba >> 16;
+	fis->lba3 = lba >> 24;
+	fis->lba4 = lba >> 32;
+	fis->lba5 = lba >> 40;
+	if (command == ATA_CMD_READ_FPDMA_QUEUED) {
+		fis->feature_low = sector_count >> 0;
+		fis->feature_high = sector_count >> 8;
+		fis->count_low = slot << 3;
+	} else {
+		fis->count_low = sector_count >> 0;
+		fis->count_high = sector_count >> 8;
+	}
+
+	uint64_t phys_addr = virt_to_phys(target);
+	unsigned int prdt_length = 0;
+	while (length > 0) {
+		uint32_t chunk = (length < AHCI_PRD_MAX_BYTES) ? length : AHCI_PRD_MAX_BYTES;
+		table->prdt[prdt_length].data_base = phys_addr;
+		table->prdt[prdt_length].reserved = 0;
+		table->prdt[prdt_length].byte_count = chunk - 1;
+		phys_addr += chunk;
+		length -= chunk;
+		prdt_length++;
+	}
+
+	ahci.command_list[slot].flags = AHCI_CMDHDR_CFL_H2D;
+	ahci.command_list[slot].prdt_length = prdt_length;
+	ahci.command_list[slot].prd_byte_count = 0;
+}
+
+static bool ahci_command_failed(void) {
+	return (mmio_read32(ahci.port, AHCI_PxIS) & AHCI_PxIS_TFES) || (mmio_read32(ahci.port, AHCI_PxTFD) & AHCI_PxTFD_ERR);
+}
+
+/* Hand a prepared slot to the HBA. The trace records it like a command of
+ * the legacy ATA driver, sector count taken from the FIS. */
+static void ahci_issue(unsigned int slot) {
+	const struct fis_reg_h2d_t *fis = &ahci.command_tables[slot].command_fis.h2d;
+	if (fis->command == ATA_CMD_READ_FPDMA_QUEUED) {
+		trace_event(TRACE_ATA_COMMAND, (fis->command << 24) | (fis->feature_high << 8) | fis->feature_low);
+		mmio_write32(ahci.port, AHCI_PxSACT, 1UL << slot);
+	} else {
+		trace_event(TRACE_ATA_COMMAND, (fis->command << 24) | (fis->count_high << 8) | fis->count_low);
+	}
+	mmio_write32(ahci.port, AHCI_PxCI, 1UL << slot);
+}
+
+/* After an error or a timeout: stopping the port aborts everything that is
+ * outstanding (and keeps the HBA from writing into memory that is reused)
+ * and clears PxCI and PxSACT. The error bits are cleared before the port is
+ * started again for the next command. */
+static void ahci_abort(void) {
+	const bool stopped = ahci_port_stop();
+	mmio_write32(ahci.port, AHCI_PxSERR, 0xffffffff);
+	mmio_write32(ahci.port, AHCI_PxIS, 0xffffffff);
+	if (!stopped || !ahci_port_start()) {
+		printmsg("stage1: ahci: port does not recover from error\n");
+	}
+	ahci_request.outstanding = 0;
+	ahci_request.outstanding_count = 0;
+	ahci_request.remaining_sectors = 0;
+}
+
+static bool ahci_execute(unsigned int slot) {
+	ahci_issue(slot);
+	const uint64_t deadline = deadline_ns(AHCI_COMMAND_TIMEOUT_MS * 1000000ULL);
+	while (mmio_read32(ahci.port, AHCI_PxCI) & (1UL << slot)) {
+		if (ahci_command_failed() || deadline_expired(deadline)) {
+			ahci_abort();
+			return false;
+		}
+		cpu_relax();
+	}
+	trace_event(TRACE_ATA_DONE, 0);
+	if (ahci_command_failed()) {
+		ahci_abort();
+		return false;
+	}
+	return true;
+}
+
+static bool ahci_identify(void) {
+	uint16_t *identify = dma_alloc(512, 512);
+	if (!identify) {
+		return false;
+	}
+	ahci_setup_command(0, ATA_CMD_IDENTIFY_DEVICE, 0, 0, identify, 512);
+	if (!ahci_execute(0)) {
+		return false;
+	}
+
+	/* Word 83, bit 10: 48 bit addressing supported, word 86, bit 10: enabled */
+	ahci.lba48 = ((identify[83] & (1 << 10)) != 0) && ((identify[86] & (1 << 10)) != 0);
+	if (ahci.lba48) {
+		ahci.sector_count = ((uint64_t)identify[103] << 48) | ((uint64_t)identify[102] << 32) | ((uint64_t)identify[101] << 16) | identify[100];
+	} else {
+		ahci.sector_count = ((uint32_t)identify[61] << 16) | identify[60];
+	}
+
+	/* Word 76, bit 8: NCQ supported, word 75 bits 4:0: queue depth - 1 */
+	if ((mmio_read32(ahci.abar, AHCI_REG_CAP) & AHCI_CAP_SNCQ) && (identify[76] & (1 << 8))) {
+		ahci.queue_depth = (identify[75] & 0x1f) + 1;
+		if (ahci.queue_depth > ahci.slot_count) {
+			ahci.queue_depth = ahci.slot_count;
+		}
+	}
+	return true;
+}
+
+/* Issue commands for the current request until it is fully submitted or no
+ * slot is free. With NCQ up to queue_depth READ FPDMA QUEUED commands are in
+ * flight; without it a single READ DMA (EXT) on slot 0 is. */
+static void ahci_submit(void) {
+	const bool ncq = ahci.queue_depth > 1;
+	const unsigned int max_outstanding = ncq ? ahci.queue_depth : 1;
+	const uint32_t max_sectors = ncq ? AHCI_NCQ_SECTORS_PER_CMD : (ahci.lba48 ? AHCI_MAX_SECTORS_PER_CMD : 256);
+	const uint8_t command = ncq ? ATA_CMD_READ_FPDMA_QUEUED : (ahci.lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA);
+	while ((ahci_request.remaining_sectors > 0) && (ahci_request.outstanding_count < max_outstanding)) {
+		unsigned int slot = __builtin_ctz(~ahci_request.outstanding);
+		uint32_t chunk_sectors = (ahci_request.remaining_sectors < max_sectors) ? ahci_request.remaining_sectors : max_sectors;
+		ahci_setup_command(slot, command, ahci_request.lba, chunk_sectors, ahci_request.target, BLOCKDEV_SECTOR_SIZE * chunk_sectors);
+		ahci_request.outstanding |= 1UL << slot;
+		ahci_request.outstanding_count++;
+		ahci_issue(slot);
+
+		ahci_request.target += BLOCKDEV_SECTOR_SIZE * chunk_sectors;
+		ahci_request.lba += chunk_sectors;
+		ahci_request.remaining_sectors -= chunk_sectors;
+	}
+}
+
+static bool ahci_read_start(uint64_t start_lba, uint32_t length_sectors, void *target) {
+	if ((start_lba + length_sectors) > ahci.sector_count) {
+		return false;
+	}
+	ahci_request.lba = start_lba;
+	ahci_request.remaining_sectors = length_sectors;
+	ahci_request.target = target;
+	ahci_submit();
+	return true;
+}
+
+/* A slot is refilled as soon as the drive reports its completion through
+ * PxSACT (NCQ) or PxCI. The timeout restarts with every completion, so it
+ * bounds a single command and not the whole read. */
+static bool ahci_read_wait(void) {
+	uint64_t deadline = deadline_ns(AHCI_COMMAND_TIMEOUT_MS * 1000000ULL);
+	while (ahci_request.outstanding != 0) {
+		if (ahci_command_failed()) {
+			ahci_abort();
+			return false;
+		}
+		uint32_t still_active = mmio_read32(ahci.port, AHCI_PxSACT) | mmio_read32(ahci.port, AHCI_PxCI);
+		uint32_t completed = ahci_request.outstanding & ~still_active;
+		if (!completed) {
+			if (deadline_expired(deadline)) {
+				ahci_abort();
+				return false;
+			}
+			cpu_relax();
+			continue;
+		}
+		ahci_request.outstanding &= ~completed;
+		while (completed) {
+			completed &= completed - 1;
+			ahci_request.outstanding_count--;
+			trace_event(TRACE_ATA_DONE, 0);
+		}
+		deadline = deadline_ns(AHCI_COMMAND_TIMEOUT_MS * 1000000ULL);
+		ahci_submit();
+	}
+	return true;
+}
+
+static bool ahci_read_sectors(uint64_t start_lba, uint32_t length_sectors, void *target) {
+	return ahci_read_start(start_lba, length_sectors, target) && ahci_read_wait();
+}
+
+static const char *ahci_transfer_name(void) {
+	return (ahci.queue_depth > 1) ? "AHCI NCQ" : "AHCI DMA";
+}
+
+bool ahci_probe(struct blockdev_t *blockdev) {
+	struct pci_function_t hba;
+	if (!pci_find_class(PCI_CLASS_SATA, PCI_SATA_PROGIF_AHCI, &hba)) {
+		return false;
+	}
+	volatile uint8_t *abar = mmio_map(pci_bar_address(&hba, PCI_AHCI_ABAR), AHCI_ABAR_SIZE);
+	if (!abar) {
+		printmsg("stage1: ahci: unable to map ABAR\n");
+		return false;
+	}
+	pci_enable(&hba, PCI_COMMAND_MEMORY_SPACE | PCI_COMMAND_BUS_MASTER);
+	ahci.abar = abar;
+	mmio_write32(abar, AHCI_REG_GHC, mmio_read32(abar, AHCI_REG_GHC) | AHCI_GHC_AE);
+
+	/* Use the first port that has an ATA drive attached */
+	const uint32_t ports_implemented = mmio_read32(abar, AHCI_REG_PI);
+	bool port_found = false;
+	for (unsigned int port = 0; port < AHCI_MAX_PORTS; port++) {
+		if ((ports_implemented & (1UL << port)) == 0) {
+			continue;
+		}
+		volatile uint8_t *port_regs = abar + AHCI_PORT_BASE(port);
+		if ((mmio_read32(port_regs, AHCI_PxSSTS) & AHCI_PxSSTS_DET_MASK) != AHCI_PxSSTS_DET_PRESENT) {
+			continue;
+		}
+		if (mmio_read32(port_regs, AHCI_PxSIG) != AHCI_SIG_ATA) {
+			continue;
+		}
+		ahci.port = port_regs;
+		ahci.port_index = port;
+		port_found = true;
+		break;
+	}
+	if (!port_found) {
+		return false;
+	}
+
+	ahci.slot_count = ((mmio_read32(abar, AHCI_REG_CAP) >> 8) & 0x1f) + 1;
+	if (!ahci_port_init() || !ahci_identify()) {
+		printmsg("stage1: ahci: port initialization failed\n");
+		return false;
+	}
+
+	printmsg("stage1: ahci: drive on port ");
+	print_decimal(ahci.port_index);
+	printmsg(" has ");
+	print_decimal(ahci.sector_count);
+	printmsg(" sectors, ");
+	print_decimal(ahci.slot_count);
+	printmsg(" command slots, NCQ depth ");
+	print_decimal(ahci.queue_depth);
+	printmsg("\n");
+
+	*blockdev = (struct blockdev_t) {
+		.name = "ahci",
+		.sector_count = ahci.sector_count,
+		.max_transfer_sectors = (ahci.queue_depth > 1) ? (ahci.queue_depth * AHCI_NCQ_SECTORS_PER_CMD) : (ahci.lba48 ? AHCI_MAX_SECTORS_PER_CMD : 256),
+		.read = ahci_read_sectors,
+		.read_start = ahci_read_start,
+		.read_wait = ahci_read_wait,
+		.transfer_name = ahci_transfer_name,
+	};
+	return true;
+}
@@ -0,0 +1,563 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage1_ata.h"
+#include "longmode_example_stage1_blockdev.h"
+#include "longmode_example_common_io.h"
+#include "longmode_example_stage1_pci.h"
+#include "longmode_example_stage1_memory.h"
+#include "longmode_example_stage1_console.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_string.h"
+#include "longmode_example_stage1_interrupt.h"
+#include "longmode_example_common_tsc.h"
+#include "longmode_example_common_trace.h"
+
+#define ATA_BASE_PORT			0x1f0
+#define ATA_CTRL_BASE_PORT		0x3f6
+#define ATA_DATA_REG			(ATA_BASE_PORT + 0)
+#define ATA_ERROR_REG			(ATA_BASE_PORT + 1)
+#define ATA_SECTOR_CNT_REG		(ATA_BASE_PORT + 2)
+#define ATA_SECTOR_LOW_REG		(ATA_BASE_PORT + 3)
+#define ATA_SECTOR_MID_REG		(ATA_BASE_PORT + 4)
+#define ATA_SECTOR_HIGH_REG		(ATA_BASE_PORT + 5)
+#define ATA_DRIVE_HEAD_REG		(ATA_BASE_PORT + 6)
+#define ATA_STATUS_REG			(ATA_BASE_PORT + 7)
+#define ATA_COMMAND_REG			(ATA_BASE_PORT + 7)
+#define ATA_CTRL_REG			(ATA_CTRL_BASE_PORT + 0)
+
+#define ATA_ALT_STATUS_REG		(ATA_CTRL_BASE_PORT + 0)
+
+#define ATA_STATUS_FLAG_BUSY	(1 << 7)
+#define ATA_STATUS_FLAG_RDY		(1 << 6)
+#define ATA_STATUS_FLAG_DF		(1 << 5)
+#define ATA_STATUS_FLAG_DRQ		(1 << 3)
+#define ATA_STATUS_FLAG_ERR		(1 << 0)
+#define ATA_CTRL_FLAG_SRST		(1 << 2)
+
+#define ATA_CMD_READ_SECTORS		0x20
+#define ATA_CMD_READ_SECTORS_EXT	0x24
+#define ATA_CMD_READ_DMA_EXT		0x25
+#define ATA_CMD_READ_MULTIPLE_EXT	0x29
+#define ATA_CMD_READ_DMA			0xc8
+#define ATA_CMD_READ_MULTIPLE		0xc4
+#define ATA_CMD_SET_MULTIPLE_MODE	0xc6
+#define ATA_CMD_IDENTIFY_DEVICE		0xec
+
+#define ATA_SECTOR_SIZE				BLOCKDEV_SECTOR_SIZE
+#define ATA_MAX_SECTORS_PER_CMD		256		/* Sector count register value 0 means 256 sectors */
+#define ATA_MAX_SECTORS_PER_CMD_EXT	65536	/* 16 bit sector count, 0 means 65536 sectors */
+
+#define ATA_RESET_TIMEOUT_MS		10000	/* Drives may need to spin up after reset */
+#define ATA_COMMAND_TIMEOUT_MS		5000
+#define ATA_SRST_HOLD_US			5		/* Minimum time SRST has to be asserted */
+#define ATA_STATUS_SETTLE_NS		400		/* Status is not valid earlier after a command */
+
+#define PCI_IDE_PROGIF_BUS_MASTER	(1 << 7)
+#define PCI_IDE_BMIDE_BAR			4
+
+/* Bus master IDE registers, primary channel, relative to BAR4 */
+#define BMIDE_COMMAND_REG			0
+#define BMIDE_STATUS_REG			2
+#define BMIDE_PRDT_REG				4
+#define BMIDE_COMMAND_START			(1 << 0)
+#define BMIDE_COMMAND_WRITE_MEMORY	(1 << 3)
+#define BMIDE_STATUS_ACTIVE			(1 << 0)
+#define BMIDE_STATUS_ERROR			(1 << 1)
+#define BMIDE_STATUS_IRQ			(1 << 2)
+#define BMIDE_PRD_MAX_BYTES			0x10000
+#define BMIDE_PRD_EOT				(1 << 15)
+
+struct prd_entry_t {
+	uint32_t phys_addr;
+	uint16_t byte_count;		/* 0 means 64 kiB */
+	uint16_t flags;
+} __attribute__ ((packed));
+
+enum ata_pio_mode_t {
+	ATA_PIO_WORD_LOOP,			/* One inw per word, stored bytewise */
+	ATA_PIO_INSW,				/* rep insw, 16 bit transfers */
+	ATA_PIO_INSL,				/* rep insl, 32 bit transfers */
+};
+
+static struct {
+	unsigned int multiple_sectors;		/* Sectors per DRQ block for READ MULTIPLE, 0 if not used */
+	bool dword_io;
+	enum ata_pio_mode_t pio_mode;
+	bool dma_capable;
+	bool use_dma;
+	bool lba48;
+	uint64_t sector_count;
+	uint32_t max_sectors_per_command;
+	uint16_t bmide_base;
+} ata_drive;
+
+/* The table must not cross a 64 kiB boundary, so it is allocated page
+ * aligned. 512 entries cover one 32 MiB LBA48 command if the target buffer is
+ * 64 kiB aligned; for unaligned buffers the command is shortened slightly. */
+#define BMIDE_PRDT_ENTRIES		512
+static struct prd_entry_t *bmide_prdt;
+
+/* The read that read_start() issued and read_wait() completes */
+static struct {
+	uint64_t lba;
+	uint32_t remaining_sectors;
+	void *target;
+	bool dma_active;
+} ata_request;
+
+/* Wait until BSY is clear and all bits in "flags" are set. Reading the
+ * status register acknowledges the drive's INTRQ, so the IRQ counter is
+ * sampled before the read: an interrupt that arrives after the read is
+ * never lost and an interrupt that arrived before it does not cause a hlt.
+ * Between polls the CPU sleeps until the drive interrupts (or the timer
+ * ticks, for conditions such as reset that do not raise an interrupt). */
+static bool ata_wait_status(uint8_t flags, unsigned int timeout_ms, uint8_t *status_out) {
+	const uint64_t deadline = deadline_ns(timeout_ms * 1000000ULL);
+	delay_ns(ATA_STATUS_SETTLE_NS);
+	while (true) {
+		unsigned int irq_last_count = irq_count(IRQ_ATA_PRIMARY);
+		uint8_t status = port_in(ATA_STATUS_REG);
+		if ((status & ATA_STATUS_FLAG_BUSY) == 0) {
+			if (((status & flags) == flags) || (status & (ATA_STATUS_FLAG_ERR | ATA_STATUS_FLAG_DF))) {
+				*status_out = status;
+				return true;
+			}
+		}
+		if (deadline_expired(deadline)) {
+			return false;
+		}
+		irq_sleep(IRQ_ATA_PRIMARY, irq_last_count);
+	}
+}
+
+static bool ata_reset(void) {
+	uint8_t status;
+	port_out(ATA_CTRL_REG, ATA_CTRL_FLAG_SRST);
+	delay_us(ATA_SRST_HOLD_US);
+	port_out(ATA_CTRL_REG, 0);		// also clears nIEN, the drive raises IRQ14 from now on
+	return ata_wait_status(ATA_STATUS_FLAG_RDY, ATA_RESET_TIMEOUT_MS, &status) && ((status & ATA_STATUS_FLAG_RDY) != 0);
+}
+
+static bool ata_wait_not_busy(void) {
+	uint8_t status;
+	if (!ata_wait_status(0, ATA_COMMAND_TIMEOUT_MS, &status)) {
+		return false;
+	}
+	return (status & (ATA_STATUS_FLAG_ERR | ATA_STATUS_FLAG_DF)) == 0;
+}
+
+static bool ata_wait_drq(void) {
+	uint8_t status;
+	if (!ata_wait_status(ATA_STATUS_FLAG_DRQ, ATA_COMMAND_TIMEOUT_MS, &status)) {
+		return false;
+	}
+	return (status & (ATA_STATUS_FLAG_ERR | ATA_STATUS_FLAG_DF)) == 0;
+}
+
+static void ata_issue_command(uint32_t lba, unsigned int sector_count, uint8_t command) {
+	trace_event(TRACE_ATA_COMMAND, (command << 24) | (sector_count & 0xffff));
+	port_out(ATA_DRIVE_HEAD_REG, 0xe0 | ((lba >> 24) & 0x0f));	// LBA, drive 0
+	port_out(ATA_SECTOR_CNT_REG, sector_count & 0xff);
+	port_out(ATA_SECTOR_LOW_REG, (lba >> 0) & 0xff);
+	port_out(ATA_SECTOR_MID_REG, (lba >> 8) & 0xff);
+	port_out(ATA_SECTOR_HIGH_REG, (lba >> 16) & 0xff);
+	port_out(ATA_COMMAND_REG, command);
+}
+
+static void ata_issue_command_ext(uint64_t lba, unsigned int sector_count, uint8_t command) {
+	trace_event(TRACE_ATA_COMMAND, (command << 24) | (sector_count & 0xffff));
+
+	/* Each register is a two byte FIFO: high order bytes are written first */
+	port_out(ATA_DRIVE_HEAD_REG, 0x40);		// LBA, drive 0
+	port_out(ATA_SECTOR_CNT_REG, (sector_count >> 8) & 0xff);
+	port_out(ATA_SECTOR_LOW_REG, (lba >> 24) & 0xff);
+	port_out(ATA_SECTOR_MID_REG, (lba >> 32) & 0xff);
+	port_out(ATA_SECTOR_HIGH_REG, (lba >> 40) & 0xff);
+	port_out(ATA_SECTOR_CNT_REG, sector_count & 0xff);
+	port_out(ATA_SECTOR_LOW_REG, (lba >> 0) & 0xff);
+	port_out(ATA_SECTOR_MID_REG, (lba >> 8) & 0xff);
+	port_out(ATA_SECTOR_HIGH_REG, (lba >> 16) & 0xff);
+	port_out(ATA_COMMAND_REG, command);
+}
+
+static void ata_issue_read(uint64_t lba, unsigned int sector_count, uint8_t command, uint8_t command_ext) {
+	if (ata_drive.lba48) {
+		ata_issue_command_ext(lba, sector_count, command_ext);
+	} else {
+		ata_issue_command(lba, sector_count, command);
+	}
+}
+
+/* Move one whole DRQ block from the data register into the target buffer */
+static void ata_read_data(void *target, unsigned int sector_count) {
+	const unsigned int length = ATA_SECTOR_SIZE * sector_count;
+	switch (ata_drive.pio_mode) {
+		case ATA_PIO_WORD_LOOP:
+			for (unsigned int i = 0; i < length; i += 2) {
+				uint16_t data_word = port_in_word(ATA_DATA_REG);
+				((uint8_t*)target)[i + 0] = data_word >> 0;
+				((uint8_t*)target)[i + 1] = data_word >> 8;
+			}
+			break;
+
+		case ATA_PIO_INSW:
+			port_in_words(ATA_DATA_REG, target, length / 2);
+			break;
+
+		case ATA_PIO_INSL:
+			port_in_dwords(ATA_DATA_REG, target, length / 4);
+			break;
+	}
+}
+
+static const char *ata_pio_mode_name(enum ata_pio_mode_t pio_mode) {
+	switch (pio_mode) {
+		case ATA_PIO_WORD_LOOP:		return "PIO (word loop)";
+		case ATA_PIO_INSW:			return "PIO (rep insw)";
+		case ATA_PIO_INSL:			return "PIO (rep insl)";
+	}
+	return "PIO";
+}
+
+static bool ata_identify(void) {
+	uint16_t identify[256];
+
+	ata_issue_command(0, 0, ATA_CMD_IDENTIFY_DEVICE);
+	if (port_in(ATA_STATUS_REG) == 0) {
+		/* No drive attached */
+		return false;
+	}
+	if (!ata_wait_drq()) {
+		return false;
+	}
+	ata_drive.pio_mode = ATA_PIO_INSW;
+	ata_read_data(identify, 1);
+	trace_event(TRACE_ATA_DONE, 0);
+
+	/* Word 49, bit 8: DMA supported */
+	ata_drive.dma_capable = (identify[49] & (1 << 8)) != 0;
+
+	/* Word 83, bit 10: 48 bit address feature set supported, word 86, bit
+	 * 10: and enabled. Capacity is then in words 100-103, otherwise in words
+	 * 60-61. */
+	ata_drive.lba48 = ((identify[83] & (1 << 10)) != 0) && ((identify[86] & (1 << 10)) != 0);
+	if (ata_drive.lba48) {
+		ata_drive.sector_count = ((uint64_t)identify[103] << 48) | ((uint64_t)identify[102] << 32) | ((uint64_t)identify[101] << 16) | identify[100];
+		ata_drive.max_sectors_per_command = ATA_MAX_SECTORS_PER_CMD_EXT;
+	} else {
+		ata_drive.sector_count = ((uint32_t)identify[61] << 16) | identify[60];
+		ata_drive.max_sectors_per_command = ATA_MAX_SECTORS_PER_CMD;
+	}
+
+	/* Word 47, bits 7:0: maximum number of sectors per DRQ block for READ
+	 * MULTIPLE. SET MULTIPLE MODE only accepts powers of two. */
+	unsigned int max_multiple = identify[47] & 0xff;
+	ata_drive.multiple_sectors = 0;
+	if (max_multiple > 1) {
+		unsigned int multiple = 1;
+		while ((multiple * 2) <= max_multiple) {
+			multiple *= 2;
+		}
+		ata_issue_command(0, multiple, ATA_CMD_SET_MULTIPLE_MODE);
+		if (ata_wait_not_busy()) {
+			ata_drive.multiple_sectors = multiple;
+		}
+		trace_event(TRACE_ATA_DONE, 0);
+	}
+	return true;
+}
+
+static bool ata_read_sectors_pio(uint64_t start_lba, uint32_t length_sectors, void *target) {
+	const uint8_t command = ata_drive.multiple_sectors ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ_SECTORS;
+	const uint8_t command_ext = ata_drive.multiple_sectors ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_SECTORS_EXT;
+	const unsigned int block_sectors = ata_drive.multiple_sectors ? ata_drive.multiple_sectors : 1;
+
+	while (length_sectors > 0) {
+		unsigned int chunk_sectors = (length_sectors < ata_drive.max_sectors_per_command) ? length_sectors : ata_drive.max_sectors_per_command;
+		ata_issue_read(start_lba, chunk_sectors, command, command_ext);
+
+		/* Drain one DRQ block after the other until the command is done */
+		unsigned int remaining_sectors = chunk_sectors;
+		while (remaining_sectors > 0) {
+			unsigned int drq_sectors = (remaining_sectors < block_sectors) ? remaining_sectors : block_sectors;
+			if (!ata_wait_drq()) {
+				return false;
+			}
+			ata_read_data(target, drq_sectors);
+			target += ATA_SECTOR_SIZE * drq_sectors;
+			remaining_sectors -= drq_sectors;
+		}
+		trace_event(TRACE_ATA_DONE, 0);
+
+		start_lba += chunk_sectors;
+		length_sectors -= chunk_sectors;
+	}
+	return true;
+}
+
+static bool bmide_init(void) {
+	struct pci_function_t ide;
+	if (!pci_find_class(PCI_CLASS_IDE, PCI_IDE_PROGIF_BUS_MASTER, &ide)) {
+		return false;
+	}
+	if ((pci_config_read(&ide, PCI_REG_BAR0 + (4 * PCI_IDE_BMIDE_BAR)) & PCI_BAR_IO) == 0) {
+		return false;
+	}
+
+	bmide_prdt = dma_alloc(BMIDE_PRDT_ENTRIES * sizeof(struct prd_entry_t), 4096);
+	if (!bmide_prdt) {
+		return false;
+	}
+	ata_drive.bmide_base = pci_bar_address(&ide, PCI_IDE_BMIDE_BAR);
+	pci_enable(&ide, PCI_COMMAND_IO_SPACE | PCI_COMMAND_BUS_MASTER);
+	return true;
+}
+
+/* Describe a physically contiguous buffer in the PRD table; no entry may
+ * cross a 64 kiB boundary. */
+static void bmide_setup_prdt(uint64_t phys_addr, uint32_t length) {
+	unsigned int index = 0;
+	while (length > 0) {
+		uint32_t chunk = BMIDE_PRD_MAX_BYTES - (phys_addr & (BMIDE_PRD_MAX_BYTES - 1));
+		if (chunk > length) {
+			chunk = length;
+		}
+		bmide_prdt[index].phys_addr = phys_addr;
+		bmide_prdt[index].byte_count = chunk & 0xffff;
+		bmide_prdt[index].flags = 0;
+		phys_addr += chunk;
+		length -= chunk;
+		index++;
+	}
+	bmide_prdt[index - 1].flags = BMIDE_PRD_EOT;
+}
+
+/* Program the PRD table for the next command of the current request and
+ * start it; the request is advanced past the sectors covered */
+static void ata_dma_issue(void) {
+	const uint16_t bmide = ata_drive.bmide_base;
+	const uint64_t target_phys = virt_to_phys(ata_request.target);
+	const uint32_t prdt_max_sectors = ((BMIDE_PRDT_ENTRIES * BMIDE_PRD_MAX_BYTES) - (target_phys & (BMIDE_PRD_MAX_BYTES - 1))) / ATA_SECTOR_SIZE;
+	unsigned int chunk_sectors = (ata_request.remaining_sectors < ata_drive.max_sectors_per_command) ? ata_request.remaining_sectors : ata_drive.max_sectors_per_command;
+	if (chunk_sectors > prdt_max_sectors) {
+		chunk_sectors = prdt_max_sectors;
+	}
+	bmide_setup_prdt(target_phys, ATA_SECTOR_SIZE * chunk_sectors);
+
+	port_out(bmide + BMIDE_COMMAND_REG, 0);
+	port_out_dword(bmide + BMIDE_PRDT_REG, virt_to_phys(bmide_prdt));
+	port_out(bmide + BMIDE_STATUS_REG, BMIDE_STATUS_ERROR | BMIDE_STATUS_IRQ);		// write 1 to clear
+	port_out(bmide + BMIDE_COMMAND_REG, BMIDE_COMMAND_WRITE_MEMORY);
+
+	ata_issue_read(ata_request.lba, chunk_sectors, ATA_CMD_READ_DMA, ATA_CMD_READ_DMA_EXT);
+	port_out(bmide + BMIDE_COMMAND_REG, BMIDE_COMMAND_WRITE_MEMORY | BMIDE_COMMAND_START);
+	ata_request.dma_active = true;
+
+	ata_request.target += ATA_SECTOR_SIZE * chunk_sectors;
+	ata_request.lba += chunk_sectors;
+	ata_request.remaining_sectors -= chunk_sectors;
+}
+
+static bool ata_dma_complete(void) {
+	const uint16_t bmide = ata_drive.bmide_base;
+
+	/* The IRQ bit latches the drive's INTRQ, sleep until it shows up */
+	const uint64_t deadline = deadline_ns(ATA_COMMAND_TIMEOUT_MS * 1000000ULL);
+	uint8_t bm_status;
+	while (true) {
+		unsigned int irq_last_count = irq_count(IRQ_ATA_PRIMARY);
+		bm_status = port_in(bmide + BMIDE_STATUS_REG);
+		if (bm_status & (BMIDE_STATUS_IRQ | BMIDE_STATUS_ERROR)) {
+			break;
+		}
+		if (deadline_expired(deadline)) {
+			bm_status |= BMIDE_STATUS_ERROR;
+			break;
+		}
+		irq_sleep(IRQ_ATA_PRIMARY, irq_last_count);
+	}
+	port_out(bmide + BMIDE_COMMAND_REG, 0);
+	ata_request.dma_active = false;
+	trace_event(TRACE_ATA_DONE, 0);
+
+	bool ata_ok = ata_wait_not_busy();
+	port_out(bmide + BMIDE_STATUS_REG, BMIDE_STATUS_ERROR | BMIDE_STATUS_IRQ);
+	return ata_ok && ((bm_status & BMIDE_STATUS_ERROR) == 0);
+}
+
+static bool ata_read_start(uint64_t start_lba, uint32_t length_sectors, void *target) {
+	if ((start_lba + length_sectors) > ata_drive.sector_count) {
+		return false;
+	}
+	ata_request.lba = start_lba;
+	ata_request.remaining_sectors = length_sectors;
+	ata_request.target = target;
+	if (ata_drive.use_dma && (length_sectors > 0)) {
+		ata_dma_issue();
+	}
+	return true;
+}
+
+static bool ata_read_wait(void) {
+	if (!ata_drive.use_dma) {
+		return ata_read_sectors_pio(ata_request.lba, ata_request.remaining_sectors, ata_request.target);
+	}
+	while (ata_request.dma_active) {
+		if (!ata_dma_complete()) {
+			return false;
+		}
+		if (ata_request.remaining_sectors > 0) {
+			ata_dma_issue();
+		}
+	}
+	return true;
+}
+
+static bool ata_read_sectors(uint64_t start_lba, uint32_t length_sectors, void *target) {
+	return ata_read_start(start_lba, length_sectors, target) && ata_read_wait();
+}
+
+static const char *ata_transfer_name(void) {
+	return ata_drive.use_dma ? "DMA" : ata_pio_mode_name(ata_drive.pio_mode);
+}
+
+/* Read and discard data words until the drive drops DRQ, so that a transfer
+ * that went wrong does not leave it in the middle of a DRQ block */
+static bool ata_drain_data(void) {
+	const uint64_t deadline = deadline_ns(ATA_COMMAND_TIMEOUT_MS * 1000000ULL);
+	while (true) {
+		const uint8_t status = port_in(ATA_ALT_STATUS_REG);
+		if ((status & (ATA_STATUS_FLAG_BUSY | ATA_STATUS_FLAG_DRQ)) == 0) {
+			return true;
+		}
+		if (deadline_expired(deadline)) {
+			return false;
+		}
+		if ((status & (ATA_STATUS_FLAG_BUSY | ATA_STATUS_FLAG_DRQ)) == ATA_STATUS_FLAG_DRQ) {
+			port_in_word(ATA_DATA_REG);
+		} else {
+			cpu_relax();
+		}
+	}
+}
+
+/* Whether 32 bit accesses to the data register work depends on the host
+ * controller, not on the drive (word 48 of IDENTIFY, which once said so, is
+ * obsolete and has been reused since). Read LBA 0 both ways and only use
+ * rep insl if the results agree. */
+static bool ata_verify_dword_io(void) {
+	uint8_t sector_words[ATA_SECTOR_SIZE];
+	uint8_t sector_dwords[ATA_SECTOR_SIZE];
+	ata_drive.pio_mode = ATA_PIO_INSW;
+	if (!ata_read_sectors_pio(0, 1, sector_words)) {
+		return false;
+	}
+	ata_drive.pio_mode = ATA_PIO_INSL;
+	const bool dword_io = ata_read_sectors_pio(0, 1, sector_dwords) && (memcmp(sector_words, sector_dwords, ATA_SECTOR_SIZE) == 0);
+	if (!dword_io && !ata_drain_data()) {
+		/* Stuck mid transfer: reset the drive and set it up again, which
+		 * also restores the READ MULTIPLE block size */
+		if (!ata_reset() || !ata_identify()) {
+			printmsg("stage1: ata: drive does not recover from the 32 bit PIO test\n");
+		}
+	}
+	ata_drive.pio_mode = dword_io ? ATA_PIO_INSL : ATA_PIO_INSW;
+	return dword_io;
+}
+
+/* Re-read stage 2 with all PIO transfer modes */
+static void ata_benchmark(uint64_t start_lba, uint32_t length_sectors, void *target) {
+	const enum ata_pio_mode_t active_pio_mode = ata_drive.pio_mode;
+	const enum ata_pio_mode_t max_pio_mode = ata_drive.dword_io ? ATA_PIO_INSL : ATA_PIO_INSW;
+	for (enum ata_pio_mode_t pio_mode = ATA_PIO_WORD_LOOP; pio_mode <= max_pio_mode; pio_mode++) {
+		ata_drive.pio_mode = pio_mode;
+		uint64_t t_start = rdtsc();
+		if (!ata_read_sectors_pio(start_lba, length_sectors, target)) {
+			printmsg("stage1: error re-reading using PIO\n");
+			break;
+		}
+		print_throughput(ata_pio_mode_name(pio_mode), length_sectors, rdtsc() - t_start);
+	}
+	ata_drive.pio_mode = active_pio_mode;
+}
+
+/* A DMA transfer is further limited by the PRDT, of which one entry may be
+ * lost to a target that is not 64 KiB aligned */
+static uint32_t ata_max_transfer_sectors(void) {
+	const uint32_t prdt_sectors = ((BMIDE_PRDT_ENTRIES - 1) * BMIDE_PRD_MAX_BYTES) / ATA_SECTOR_SIZE;
+	if (ata_drive.use_dma && (prdt_sectors < ata_drive.max_sectors_per_command)) {
+		return prdt_sectors;
+	}
+	return ata_drive.max_sectors_per_command;
+}
+
+bool ata_probe(struct blockdev_t *blockdev) {
+	if (port_in(ATA_STATUS_REG) == 0xff) {
+		/* Floating bus, no legacy IDE controller present */
+		return false;
+	}
+
+	irq_enable(IRQ_ATA_PRIMARY);
+	if (!ata_reset()) {
+		printmsg("stage1: ata: timeout waiting for drive after reset\n");
+		return false;
+	}
+	if (!ata_identify()) {
+		return false;
+	}
+	ata_drive.dword_io = ata_verify_dword_io();
+	if (ata_drive.multiple_sectors) {
+		printmsg("stage1: ata: using READ MULTIPLE with ");
+		print_decimal(ata_drive.multiple_sectors);
+		printmsg(" sectors per DRQ block\n");
+	} else {
+		printmsg("stage1: ata: READ MULTIPLE unsupported, using READ SECTORS\n");
+	}
+	printmsg("stage1: ata: drive has ");
+	print_decimal(ata_drive.sector_count);
+	printmsg(ata_drive.lba48 ? " sectors, using LBA48\n" : " sectors, using LBA28\n");
+	if (ata_drive.dma_capable && bmide_init()) {
+		ata_drive.use_dma = true;
+		printmsg("stage1: ata: using bus master IDE DMA at I/O port ");
+		print_uint32(ata_drive.bmide_base);
+		printmsg("\n");
+	} else {
+		printmsg("stage1: ata: no bus master IDE function found, using PIO\n");
+	}
+
+	*blockdev = (struct blockdev_t) {
+		.name = "ata",
+		.sector_count = ata_drive.sector_count,
+		.max_transfer_sectors = ata_max_transfer_sectors(),
+		.read = ata_read_sectors,
+		.read_start = ata_read_start,
+		.read_wait = ata_read_wait,
+		.transfer_name = ata_transfer_name,
+		.benchmark = ata_benchmark,
+	};
+	return true;
+}
+
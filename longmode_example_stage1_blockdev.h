@@ -0,0 +1,81 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_STAGE1_BLOCKDEV_H__
+#define __LONGMODE_EXAMPLE_STAGE1_BLOCKDEV_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BLOCKDEV_SECTOR_SIZE		512
+#define MBR_SIGNATURE				0xaa55
+
+struct partition_t {
+	uint8_t status;
+	uint8_t chs_start[3];
+	uint8_t part_type;
+	uint8_t chs_end[3];
+	uint32_t lba_start;
+	uint32_t length_sectors;
+} __attribute__ ((packed));
+
+struct mbr_t {
+	uint8_t bootloader[440];
+	uint32_t disk_signature;
+	uint16_t empty;
+	struct partition_t partition[4];
+	uint16_t mbr_signature;
+} __attribute__ ((packed));
+
+_Static_assert(sizeof(struct mbr_t) == 512, "MBR structure not 512 bytes long");
+
+/* A disk that stage 2 can be loaded from. Each backend only ever drives a
+ * single disk, so its state lives in the backend itself. */
+struct blockdev_t {
+	const char *name;
+	uint64_t sector_count;
+
+	/* Most sectors that one read_start() moves in a single round of
+	 * commands the device works on at once, 0 if unlimited. Longer reads are
+	 * split and pay another round trip. */
+	uint32_t max_transfer_sectors;
+
+	/* Read sectors into a buffer that is physically contiguous */
+	bool (*read)(uint64_t lba, uint32_t sector_count, void *target);
+
+	/* The same read split in two: read_start() issues the transfer and
+	 * returns as soon as the device is busy with it, read_wait() blocks
+	 * until it is complete. Only one read may be outstanding at a time;
+	 * backends that cannot overlap (PIO) do all the work in read_wait(). */
+	bool (*read_start)(uint64_t lba, uint32_t sector_count, void *target);
+	bool (*read_wait)(void);
+
+	/* Name of the transfer mode in use, for throughput reports */
+	const char *(*transfer_name)(void);
+
+	/* Optional: re-read the given extent using alternative transfer modes
+	 * and print the throughput of each */
+	void (*benchmark)(uint64_t lba, uint32_t sector_count, void *target);
+};
+
+#endif
@@ -0,0 +1,112 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage1_bootinfo.h"
+#include "longmode_example_common_io.h"
+#include "longmode_example_common_console.h"
+
+#define CMOS_INDEX_PORT			0x70
+#define CMOS_DATA_PORT			0x71
+#define CMOS_EXT_MEM_LOW		0x30		/* 1 kiB units above 1 MiB */
+#define CMOS_EXT_MEM_HIGH		0x31
+#define CMOS_MEM_16M_LOW		0x34		/* 64 kiB units above 16 MiB */
+#define CMOS_MEM_16M_HIGH		0x35
+#define CMOS_MEM_4G_0			0x5b		/* 64 kiB units above 4 GiB */
+#define CMOS_MEM_4G_1			0x5c
+#define CMOS_MEM_4G_2			0x5d
+
+#define CONVENTIONAL_MEMORY_END	0x9fc00
+#define FOUR_GIB				0x100000000ULL
+
+static struct bootinfo_t bootinfo;
+
+static uint8_t cmos_read(uint8_t reg) {
+	port_out(CMOS_INDEX_PORT, reg);
+	return port_in(CMOS_DATA_PORT);
+}
+
+/* Insert sorted by base address, dropping empty entries */
+static void bootinfo_add_memory(uint64_t base, uint64_t length, uint32_t type) {
+	if ((length == 0) || (bootinfo.e820_count == BOOTINFO_E820_MAX_ENTRIES)) {
+		return;
+	}
+	unsigned int index = bootinfo.e820_count;
+	while ((index > 0) && (bootinfo.e820[index - 1].base > base)) {
+		bootinfo.e820[index] = bootinfo.e820[index - 1];
+		index--;
+	}
+	bootinfo.e820[index] = (struct e820_entry_t) {
+		.base = base,
+		.length = length,
+		.type = type,
+		.acpi_attributes = 1,
+	};
+	bootinfo.e820_count++;
+}
+
+/* Without an E820 map, fall back to the memory size registers that the BIOS
+ * leaves in the CMOS (Bochs and QEMU also report memory above 4 GiB there) */
+static void bootinfo_memory_from_cmos(void) {
+	const uint32_t mem_16m_blocks = (cmos_read(CMOS_MEM_16M_HIGH) << 8) | cmos_read(CMOS_MEM_16M_LOW);
+	bootinfo_add_memory(0, CONVENTIONAL_MEMORY_END, E820_TYPE_RAM);
+	if (mem_16m_blocks) {
+		bootinfo_add_memory(0x100000, (15 * 1024 * 1024) + ((uint64_t)mem_16m_blocks << 16), E820_TYPE_RAM);
+	} else {
+		bootinfo_add_memory(0x100000, (uint64_t)((cmos_read(CMOS_EXT_MEM_HIGH) << 8) | cmos_read(CMOS_EXT_MEM_LOW)) << 10, E820_TYPE_RAM);
+	}
+	const uint32_t mem_4g_blocks = (cmos_read(CMOS_MEM_4G_2) << 16) | (cmos_read(CMOS_MEM_4G_1) << 8) | cmos_read(CMOS_MEM_4G_0);
+	bootinfo_add_memory(FOUR_GIB, (uint64_t)mem_4g_blocks << 16, E820_TYPE_RAM);
+}
+
+/* Pick up the memory map that stage 0 collected from int 15h, e820 */
+struct bootinfo_t *bootinfo_init(void) {
+	const volatile uint32_t *e820_count = low_memory(BOOTINFO_E820_COUNT_ADDR);
+	const volatile struct e820_entry_t *e820_map = low_memory(BOOTINFO_E820_MAP_ADDR);
+	const unsigned int count = (*e820_count < BOOTINFO_E820_MAX_ENTRIES) ? *e820_count : BOOTINFO_E820_MAX_ENTRIES;
+	for (unsigned int i = 0; i < count; i++) {
+		/* Bit 0 of the ACPI 3.0 attributes clear means "ignore this entry" */
+		if (e820_map[i].acpi_attributes & 1) {
+			bootinfo_add_memory(e820_map[i].base, e820_map[i].length, e820_map[i].type);
+		}
+	}
+
+	if (bootinfo.e820_count == 0) {
+		printmsg("stage1: no E820 memory map, using CMOS memory size\n");
+		bootinfo_memory_from_cmos();
+	}
+
+	uint64_t ram_bytes = 0;
+	for (unsigned int i = 0; i < bootinfo.e820_count; i++) {
+		if (bootinfo.e820[i].type == E820_TYPE_RAM) {
+			ram_bytes += bootinfo.e820[i].length;
+		}
+	}
+	printmsg("stage1: memory map has ");
+	print_decimal(bootinfo.e820_count);
+	printmsg(" entries, ");
+	print_decimal(ram_bytes >> 20);
+	printmsg(" MiB usable RAM\n");
+	return &bootinfo;
+}
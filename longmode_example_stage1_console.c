@@ -0,0 +1,42 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include "longmode_example_stage1_console.h"
+#include "longmode_example_common_console.h"
+
+void print_throughput(const char *mode, uint32_t length_sectors, uint64_t cycles) {
+	printfmt("stage1: %s read %u sectors in %lu cycles, %lu cycles/sector\n", mode, length_sectors, cycles, cycles / (length_sectors ? length_sectors : 1));
+}
+
+#if 0
+static void print_hexdump(const uint8_t *data, unsigned int length) {
+	const unsigned int line_length = 16;
+	for (int i = 0; i < length; i++) {
+		printfmt("%02x ", data[i]);
+		if (i && ((i % line_length) == line_length - 1)) {
+			cursor_newline();
+		}
+	}
+}
+#endif
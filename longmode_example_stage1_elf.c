@@ -0,0 +1,109 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage1_elf.h"
+#include "longmode_example_stage1_memory.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_string.h"
+
+#define ELF_MAGIC				0x464c457f		/* "\x7fELF" */
+#define ELF_CLASS_64			2
+#define ELF_DATA_LSB			1
+#define ELF_TYPE_EXEC			2
+#define ELF_MACHINE_X86_64		62
+#define ELF_PT_LOAD				1
+
+struct elf64_header_t {
+	uint32_t magic;
+	uint8_t elf_class;
+	uint8_t data;
+	uint8_t version;
+	uint8_t os_abi;
+	uint8_t padding[8];
+	uint16_t type;
+	uint16_t machine;
+	uint32_t elf_version;
+	uint64_t entry;
+	uint64_t phoff;
+	uint64_t shoff;
+	uint32_t flags;
+	uint16_t ehsize;
+	uint16_t phentsize;
+	uint16_t phnum;
+	uint16_t shentsize;
+	uint16_t shnum;
+	uint16_t shstrndx;
+} __attribute__ ((packed));
+
+struct elf64_program_header_t {
+	uint32_t type;
+	uint32_t flags;
+	uint64_t offset;
+	uint64_t vaddr;
+	uint64_t paddr;
+	uint64_t filesz;
+	uint64_t memsz;
+	uint64_t align;
+} __attribute__ ((packed));
+
+_Static_assert(sizeof(struct elf64_header_t) == 64, "ELF64 header not 64 bytes long");
+_Static_assert(sizeof(struct elf64_program_header_t) == 56, "ELF64 program header not 56 bytes long");
+
+/* Copy the PT_LOAD segments of the ELF file at "image" to their virtual
+ * addresses. Their bss part is not touched, stage 2 clears it itself in
+ * its early init. Segments must lie entirely within [load_base,
+ * load_limit), which must not overlap the file itself. */
+bool elf_load(const void *image, uint32_t image_size, uint64_t load_base, uint64_t load_limit, uint64_t *entry) {
+	const struct elf64_header_t *header = image;
+	if ((image_size < sizeof(struct elf64_header_t)) || (header->magic != ELF_MAGIC) || (header->elf_class != ELF_CLASS_64) || (header->data != ELF_DATA_LSB)) {
+		printmsg("stage1: stage 2 is not an ELF64 file\n");
+		return false;
+	}
+	if ((header->type != ELF_TYPE_EXEC) || (header->machine != ELF_MACHINE_X86_64) || (header->phentsize != sizeof(struct elf64_program_header_t))) {
+		printmsg("stage1: stage 2 is not an x86_64 executable\n");
+		return false;
+	}
+	if (header->phoff + ((uint64_t)header->phnum * sizeof(struct elf64_program_header_t)) > image_size) {
+		printmsg("stage1: stage 2 program headers truncated\n");
+		return false;
+	}
+
+	const struct elf64_program_header_t *program_headers = image + header->phoff;
+	for (unsigned int i = 0; i < header->phnum; i++) {
+		const struct elf64_program_header_t *phdr = &program_headers[i];
+		if (phdr->type != ELF_PT_LOAD) {
+			continue;
+		}
+		if ((phdr->filesz > phdr->memsz) || (phdr->offset + phdr->filesz > image_size) || (phdr->vaddr < load_base) || (phdr->vaddr + phdr->memsz > load_limit)) {
+			printmsg("stage1: stage 2 segment at ");
+			print_uint64(phdr->vaddr);
+			printmsg(" does not fit\n");
+			return false;
+		}
+		memcpy((void*)phdr->vaddr, image + phdr->offset, phdr->filesz);
+	}
+	*entry = header->entry;
+	return true;
+}
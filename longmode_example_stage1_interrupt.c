@@ -0,0 +1,234 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage1_interrupt.h"
+#include "longmode_example_common_io.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_serial.h"
+
+#define IDT_ENTRY_COUNT			(IRQ_VECTOR_BASE + IRQ_COUNT)
+#define IDT_CODE_SELECTOR		8			/* gdt64_entry_cs */
+#define IDT_TYPE_INTERRUPT_GATE	0x8e		/* Present, DPL 0, 64 bit interrupt gate */
+
+#define PIC_MASTER_COMMAND		0x20
+#define PIC_MASTER_DATA			0x21
+#define PIC_SLAVE_COMMAND		0xa0
+#define PIC_SLAVE_DATA			0xa1
+#define PIC_ICW1_INIT_ICW4		0x11
+#define PIC_ICW4_8086			0x01
+#define PIC_OCW2_EOI			0x20
+#define PIC_OCW3_READ_ISR		0x0b
+#define PIC_CASCADE_IRQ			2
+
+/* PIT channel 0 in mode 2 (rate generator), lobyte/hibyte access */
+#define PIT_CHANNEL0_DATA		0x40
+#define PIT_COMMAND				0x43
+#define PIT_COMMAND_CH0_MODE2	0x34
+#define PIT_INPUT_FREQUENCY_HZ	1193182
+
+struct idt_entry_t {
+	uint16_t offset_low;
+	uint16_t selector;
+	uint8_t ist;
+	uint8_t type_attributes;
+	uint16_t offset_mid;
+	uint32_t offset_high;
+	uint32_t reserved;
+} __attribute__ ((packed));
+
+struct idt_descriptor_t {
+	uint16_t limit;
+	uint64_t base;
+} __attribute__ ((packed));
+
+struct interrupt_frame_t {
+	uint64_t rip;
+	uint64_t cs;
+	uint64_t rflags;
+	uint64_t rsp;
+	uint64_t ss;
+};
+
+static struct idt_entry_t idt[IDT_ENTRY_COUNT] __attribute__ ((aligned(16)));
+static volatile unsigned int irq_counts[IRQ_COUNT];
+static uint16_t irq_unmasked = 1 << PIC_CASCADE_IRQ;
+
+static void __attribute__ ((noreturn)) exception_fatal(unsigned int vector, uint64_t error_code, const struct interrupt_frame_t *frame) {
+	printmsg("stage1: exception ");
+	print_decimal(vector);
+	printmsg(" error code ");
+	print_uint64(error_code);
+	printmsg(" at RIP ");
+	print_uint64(frame->rip);
+	printmsg(", halting\n");
+	while (true) {
+		__asm__ __volatile__("cli; hlt");
+	}
+}
+
+#define EXCEPTION_HANDLER(vector)																			\
+	static void __attribute__ ((interrupt)) exception_handler_ ## vector(struct interrupt_frame_t *frame) {	\
+		exception_fatal(vector, 0, frame);																	\
+	}
+#define EXCEPTION_HANDLER_ERROR_CODE(vector)																					\
+	static void __attribute__ ((interrupt)) exception_handler_ ## vector(struct interrupt_frame_t *frame, uint64_t error_code) {	\
+		exception_fatal(vector, error_code, frame);																				\
+	}
+
+EXCEPTION_HANDLER(0) EXCEPTION_HANDLER(1) EXCEPTION_HANDLER(2) EXCEPTION_HANDLER(3)
+EXCEPTION_HANDLER(4) EXCEPTION_HANDLER(5) EXCEPTION_HANDLER(6) EXCEPTION_HANDLER(7)
+EXCEPTION_HANDLER_ERROR_CODE(8) EXCEPTION_HANDLER(9) EXCEPTION_HANDLER_ERROR_CODE(10) EXCEPTION_HANDLER_ERROR_CODE(11)
+EXCEPTION_HANDLER_ERROR_CODE(12) EXCEPTION_HANDLER_ERROR_CODE(13) EXCEPTION_HANDLER_ERROR_CODE(14) EXCEPTION_HANDLER(15)
+EXCEPTION_HANDLER(16) EXCEPTION_HANDLER_ERROR_CODE(17) EXCEPTION_HANDLER(18) EXCEPTION_HANDLER(19)
+EXCEPTION_HANDLER(20) EXCEPTION_HANDLER_ERROR_CODE(21) EXCEPTION_HANDLER(22) EXCEPTION_HANDLER(23)
+EXCEPTION_HANDLER(24) EXCEPTION_HANDLER(25) EXCEPTION_HANDLER(26) EXCEPTION_HANDLER(27)
+EXCEPTION_HANDLER(28) EXCEPTION_HANDLER_ERROR_CODE(29) EXCEPTION_HANDLER_ERROR_CODE(30) EXCEPTION_HANDLER(31)
+
+static void irq_dispatch(unsigned int irq) {
+	if ((irq == 7) || (irq == 15)) {
+		/* Spurious interrupts do not set the in-service bit and must not be
+		 * acknowledged at the PIC that raised them */
+		const unsigned int command_port = (irq == 7) ? PIC_MASTER_COMMAND : PIC_SLAVE_COMMAND;
+		port_out(command_port, PIC_OCW3_READ_ISR);
+		if ((port_in(command_port) & (1 << 7)) == 0) {
+			if (irq == 15) {
+				port_out(PIC_MASTER_COMMAND, PIC_OCW2_EOI);
+			}
+			return;
+		}
+	}
+
+	irq_counts[irq]++;
+	if (irq == IRQ_TIMER) {
+		/* Keep the console output moving while the CPU is halted */
+		serial_poll();
+	}
+	if (irq >= 8) {
+		port_out(PIC_SLAVE_COMMAND, PIC_OCW2_EOI);
+	}
+	port_out(PIC_MASTER_COMMAND, PIC_OCW2_EOI);
+}
+
+#define IRQ_HANDLER(irq)																			\
+	static void __attribute__ ((interrupt)) irq_handler_ ## irq(struct interrupt_frame_t *frame) {	\
+		irq_dispatch(irq);																			\
+	}
+
+IRQ_HANDLER(0) IRQ_HANDLER(1) IRQ_HANDLER(2) IRQ_HANDLER(3)
+IRQ_HANDLER(4) IRQ_HANDLER(5) IRQ_HANDLER(6) IRQ_HANDLER(7)
+IRQ_HANDLER(8) IRQ_HANDLER(9) IRQ_HANDLER(10) IRQ_HANDLER(11)
+IRQ_HANDLER(12) IRQ_HANDLER(13) IRQ_HANDLER(14) IRQ_HANDLER(15)
+
+static const void *idt_handlers[IDT_ENTRY_COUNT] = {
+	exception_handler_0, exception_handler_1, exception_handler_2, exception_handler_3,
+	exception_handler_4, exception_handler_5, exception_handler_6, exception_handler_7,
+	exception_handler_8, exception_handler_9, exception_handler_10, exception_handler_11,
+	exception_handler_12, exception_handler_13, exception_handler_14, exception_handler_15,
+	exception_handler_16, exception_handler_17, exception_handler_18, exception_handler_19,
+	exception_handler_20, exception_handler_21, exception_handler_22, exception_handler_23,
+	exception_handler_24, exception_handler_25, exception_handler_26, exception_handler_27,
+	exception_handler_28, exception_handler_29, exception_handler_30, exception_handler_31,
+	irq_handler_0, irq_handler_1, irq_handler_2, irq_handler_3,
+	irq_handler_4, irq_handler_5, irq_handler_6, irq_handler_7,
+	irq_handler_8, irq_handler_9, irq_handler_10, irq_handler_11,
+	irq_handler_12, irq_handler_13, irq_handler_14, irq_handler_15,
+};
+
+static void pic_set_mask(uint16_t unmasked) {
+	port_out(PIC_MASTER_DATA, ~unmasked & 0xff);
+	port_out(PIC_SLAVE_DATA, (~unmasked >> 8) & 0xff);
+}
+
+/* Move the IRQs of both PICs out of the exception range to IRQ_VECTOR_BASE */
+static void pic_remap(void) {
+	port_out(PIC_MASTER_COMMAND, PIC_ICW1_INIT_ICW4);
+	port_out(PIC_SLAVE_COMMAND, PIC_ICW1_INIT_ICW4);
+	port_out(PIC_MASTER_DATA, IRQ_VECTOR_BASE);
+	port_out(PIC_SLAVE_DATA, IRQ_VECTOR_BASE + 8);
+	port_out(PIC_MASTER_DATA, 1 << PIC_CASCADE_IRQ);
+	port_out(PIC_SLAVE_DATA, PIC_CASCADE_IRQ);
+	port_out(PIC_MASTER_DATA, PIC_ICW4_8086);
+	port_out(PIC_SLAVE_DATA, PIC_ICW4_8086);
+}
+
+static void pit_init(void) {
+	const uint16_t divisor = PIT_INPUT_FREQUENCY_HZ / TIMER_HZ;
+	port_out(PIT_COMMAND, PIT_COMMAND_CH0_MODE2);
+	port_out(PIT_CHANNEL0_DATA, (divisor >> 0) & 0xff);
+	port_out(PIT_CHANNEL0_DATA, (divisor >> 8) & 0xff);
+}
+
+/* Install the IDT, route the legacy PIC and start the timer tick. Only the
+ * timer IRQ is unmasked; drivers unmask their own IRQ with irq_enable(). */
+void interrupt_init(void) {
+	for (unsigned int vector = 0; vector < IDT_ENTRY_COUNT; vector++) {
+		uint64_t offset = (uint64_t)idt_handlers[vector];
+		idt[vector] = (struct idt_entry_t) {
+			.offset_low = (offset >> 0) & 0xffff,
+			.selector = IDT_CODE_SELECTOR,
+			.type_attributes = IDT_TYPE_INTERRUPT_GATE,
+			.offset_mid = (offset >> 16) & 0xffff,
+			.offset_high = (offset >> 32) & 0xffffffff,
+		};
+	}
+	struct idt_descriptor_t idt_descriptor = {
+		.limit = sizeof(idt) - 1,
+		.base = (uint64_t)idt,
+	};
+	__asm__ __volatile__("lidt %0" : : "m"(idt_descriptor));
+
+	pic_remap();
+	pit_init();
+	irq_enable(IRQ_TIMER);
+	__asm__ __volatile__("sti");
+}
+
+/* Mask everything again so that the next stage starts with the state the
+ * firmware left (no interrupts) and does not depend on the stage1 IDT */
+void interrupt_shutdown(void) {
+	__asm__ __volatile__("cli");
+	pic_set_mask(0);
+}
+
+void irq_enable(unsigned int irq) {
+	irq_unmasked |= 1 << irq;
+	pic_set_mask(irq_unmasked);
+}
+
+unsigned int irq_count(unsigned int irq) {
+	return irq_counts[irq];
+}
+
+/* Halt until the next interrupt, unless "irq" has already fired since the
+ * caller sampled its counter. sti only takes effect after the following
+ * instruction, so no interrupt can slip in between the check and the hlt. */
+void irq_sleep(unsigned int irq, unsigned int last_count) {
+	__asm__ __volatile__("cli" : : : "memory");
+	if (irq_counts[irq] == last_count) {
+		__asm__ __volatile__("sti; hlt" : : : "memory");
+	} else {
+		__asm__ __volatile__("sti" : : : "memory");
+	}
+}
@@ -0,0 +1,198 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "longmode_example_stage1_loader.h"
+#include "longmode_example_stage1_blockdev.h"
+#include "longmode_example_stage1_memory.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_io.h"
+#include "longmode_example_stage1_lz4.h"
+#include "longmode_example_stage1_elf.h"
+#include "longmode_example_stage1_paging.h"
+
+/* Granularity of the pipeline: while one chunk is being transferred, the
+ * previous one is checksummed and decompressed. Chunks are as large as the
+ * backend moves at once, but the payload is split into at least this many
+ * so that there is something to overlap. */
+#define STAGE2_LOAD_MIN_CHUNKS		4
+
+#define ADLER32_MODULUS				65521
+#define ADLER32_NMAX				5552		/* Largest n such that the sums cannot overflow 32 bits */
+
+static uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t length) {
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+	while (length > 0) {
+		size_t block_length = (length < ADLER32_NMAX) ? length : ADLER32_NMAX;
+		length -= block_length;
+		while (block_length--) {
+			a += *data++;
+			b += a;
+		}
+		a %= ADLER32_MODULUS;
+		b %= ADLER32_MODULUS;
+	}
+	return (b << 16) | a;
+}
+
+/* Compressed payloads are loaded to the end of the output buffer and
+ * decoded in place. The margin guarantees that the decoder's output never
+ * catches up with compressed data that it has not consumed yet. */
+static uint32_t lz4_inplace_load_offset(uint32_t compressed_size, uint32_t uncompressed_size) {
+	const uint32_t margin = (compressed_size >> 8) + 32;
+	if (uncompressed_size + margin < compressed_size) {
+		return 0;
+	}
+	return (uncompressed_size + margin - compressed_size + BLOCKDEV_SECTOR_SIZE - 1) & ~(BLOCKDEV_SECTOR_SIZE - 1);
+}
+
+/* Stream the stage 2 payload that follows the header sector at "lba" into
+ * the stage 2 window and load the ELF file it contains. Chunk n + 1 is
+ * already in flight while chunk n is verified (and decompressed), so that
+ * this costs (almost) no additional time.
+ *
+ * Window layout: the memory image of stage 2 comes first, the ELF file is
+ * staged behind it and compressed payloads are loaded behind that again. */
+bool stage2_load(const struct blockdev_t *disk, uint64_t lba, uint32_t length_sectors, struct stage2_info_t *info) {
+	struct stage2_header_t header;
+	if (!disk->read(lba, 1, &header)) {
+		printmsg("stage1: error reading stage 2 header\n");
+		return false;
+	}
+	if (header.magic != STAGE2_HEADER_MAGIC) {
+		printmsg("stage1: stage 2 header has wrong magic\n");
+		return false;
+	}
+
+	const uint32_t payload_sectors = (header.payload_size + BLOCKDEV_SECTOR_SIZE - 1) / BLOCKDEV_SECTOR_SIZE;
+	const uint32_t staging_offset = (header.memory_size + BLOCKDEV_SECTOR_SIZE - 1) & ~(BLOCKDEV_SECTOR_SIZE - 1);
+	uint32_t load_offset = staging_offset;
+	if (header.compression == STAGE2_COMPRESSION_LZ4) {
+		load_offset += lz4_inplace_load_offset(header.payload_size, header.uncompressed_size);
+	} else if (header.compression != STAGE2_COMPRESSION_NONE) {
+		printmsg("stage1: stage 2 uses unsupported compression\n");
+		return false;
+	}
+	if (payload_sectors > length_sectors - 1) {
+		printmsg("stage1: stage 2 payload does not fit into partition\n");
+		return false;
+	}
+
+	/* Size the window for whatever ends last, the staged file or the payload */
+	uint64_t window_size = staging_offset + header.uncompressed_size;
+	if (load_offset + (BLOCKDEV_SECTOR_SIZE * payload_sectors) > window_size) {
+		window_size = load_offset + (BLOCKDEV_SECTOR_SIZE * payload_sectors);
+	}
+	if (!paging_map_stage2_window(window_size)) {
+		printmsg("stage1: unable to map a stage 2 window of ");
+		print_decimal(window_size);
+		printmsg(" bytes\n");
+		return false;
+	}
+
+	uint8_t *const window = (uint8_t*)STAGE2_VIRT_BASE;
+	uint8_t *staging = window + staging_offset;
+	uint8_t *load_target = window + load_offset;
+	struct lz4_decoder_t decoder;
+	lz4_decoder_init(&decoder, staging, header.uncompressed_size, load_target);
+
+	uint32_t adler = 1;
+	uint64_t process_cycles = 0;
+	uint32_t chunk_offset = 0;
+	uint32_t max_chunk_sectors = (payload_sectors + STAGE2_LOAD_MIN_CHUNKS - 1) / STAGE2_LOAD_MIN_CHUNKS;
+	if (disk->max_transfer_sectors && (max_chunk_sectors > disk->max_transfer_sectors)) {
+		max_chunk_sectors = disk->max_transfer_sectors;
+	}
+	uint32_t chunk_sectors = (payload_sectors < max_chunk_sectors) ? payload_sectors : max_chunk_sectors;
+	if (!disk->read_start(lba + 1, chunk_sectors, load_target)) {
+		printmsg("stage1: error reading stage 2\n");
+		return false;
+	}
+	while (chunk_sectors > 0) {
+		if (!disk->read_wait()) {
+			printmsg("stage1: error reading stage 2\n");
+			return false;
+		}
+
+		/* Kick off the next chunk before touching the one just read */
+		const uint32_t done_offset = BLOCKDEV_SECTOR_SIZE * chunk_offset;
+		chunk_offset += chunk_sectors;
+		chunk_sectors = ((payload_sectors - chunk_offset) < max_chunk_sectors) ? (payload_sectors - chunk_offset) : max_chunk_sectors;
+		if (chunk_sectors > 0) {
+			if (!disk->read_start(lba + 1 + chunk_offset, chunk_sectors, load_target + (BLOCKDEV_SECTOR_SIZE * chunk_offset))) {
+				printmsg("stage1: error reading stage 2\n");
+				return false;
+			}
+		}
+
+		uint64_t t_start = rdtsc();
+		uint32_t loaded_bytes = BLOCKDEV_SECTOR_SIZE * chunk_offset;
+		if (loaded_bytes > header.payload_size) {
+			/* Last sector is only partially used */
+			loaded_bytes = header.payload_size;
+		}
+		adler = adler32_update(adler, load_target + done_offset, loaded_bytes - done_offset);
+		if (header.compression == STAGE2_COMPRESSION_LZ4) {
+			if (!lz4_decode(&decoder, load_target + loaded_bytes, chunk_sectors == 0)) {
+				printmsg("stage1: stage 2 payload is corrupt, LZ4 decoding failed\n");
+				return false;
+			}
+		}
+		process_cycles += rdtsc() - t_start;
+	}
+
+	printmsg("stage1: stage 2 payload Adler-32 ");
+	print_uint32(adler);
+	if (adler != header.payload_adler32) {
+		printmsg(" mismatch, expected ");
+		print_uint32(header.payload_adler32);
+		printmsg("\n");
+		return false;
+	}
+	printmsg(" ok, verified ");
+	if (header.compression == STAGE2_COMPRESSION_LZ4) {
+		if (decoder.output != staging + header.uncompressed_size) {
+			printmsg("\nstage1: stage 2 payload decompressed to wrong size\n");
+			return false;
+		}
+		printmsg("and decompressed ");
+		print_decimal(header.payload_size);
+		printmsg(" -> ");
+		print_decimal(header.uncompressed_size);
+		printmsg(" bytes ");
+	}
+	printmsg("in ");
+	print_decimal(process_cycles);
+	printmsg(" cycles overlapping disk I/O\n");
+
+	if (!elf_load(staging, header.uncompressed_size, STAGE2_VIRT_BASE, STAGE2_VIRT_BASE + staging_offset, &info->entry)) {
+		return false;
+	}
+	info->payload = load_target;
+	info->payload_sectors = payload_sectors;
+	info->boot_flags = header.boot_flags;
+	return true;
+}
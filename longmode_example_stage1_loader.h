@@ -0,0 +1,64 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_STAGE1_LOADER_H__
+#define __LONGMODE_EXAMPLE_STAGE1_LOADER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage1_blockdev.h"
+
+#define STAGE2_HEADER_MAGIC			0x48325354		/* "TS2H" */
+
+#define STAGE2_COMPRESSION_NONE		0
+#define STAGE2_COMPRESSION_LZ4		1		/* LZ4 block format, no frame */
+
+/* First sector of the stage 2 partition, written by the build script. The
+ * payload starts in the sector after it and is (possibly compressed) the
+ * stage 2 ELF file, with memory_size the extent of its PT_LOAD segments
+ * from the start of the stage 2 window. */
+struct stage2_header_t {
+	uint32_t magic;
+	uint32_t payload_size;			/* Bytes */
+	uint32_t payload_adler32;		/* Of the payload as stored on disk */
+	uint32_t compression;
+	uint32_t uncompressed_size;		/* Bytes */
+	uint32_t memory_size;			/* Bytes */
+	uint32_t boot_flags;			/* BOOT_FLAG_*, passed on in bootinfo */
+	uint8_t reserved[484];
+} __attribute__ ((packed));
+
+_Static_assert(sizeof(struct stage2_header_t) == 512, "stage 2 header not 512 bytes long");
+
+struct stage2_info_t {
+	uint64_t entry;
+	void *payload;					/* Where the payload was loaded to */
+	uint32_t payload_sectors;
+	uint32_t boot_flags;
+};
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+bool stage2_load(const struct blockdev_t *disk, uint64_t lba, uint32_t length_sectors, struct stage2_info_t *info);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
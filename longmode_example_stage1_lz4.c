@@ -0,0 +1,121 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "longmode_example_stage1_lz4.h"
+
+#define LZ4_MIN_MATCH		4
+
+/* Byte granular forward copy; rep movsb is architecturally defined as a
+ * sequence of single byte moves, so it handles both overlaps that occur
+ * here: literals moving down in place and matches that repeat themselves */
+static void lz4_copy(uint8_t *dst, const uint8_t *src, size_t length) {
+	__asm__ __volatile__("rep movsb" : "+D"(dst), "+S"(src), "+c"(length) : : "memory");
+}
+
+/* Length extension bytes: keep adding while the byte is 255. Returns false
+ * if the input ends before the length is complete. */
+static bool lz4_read_length(const uint8_t **input, const uint8_t *input_end, uint32_t *length) {
+	uint8_t value;
+	do {
+		if (*input >= input_end) {
+			return false;
+		}
+		value = *(*input)++;
+		*length += value;
+	} while (value == 255);
+	return true;
+}
+
+void lz4_decoder_init(struct lz4_decoder_t *decoder, void *output, uint32_t output_length, const void *input) {
+	decoder->input = input;
+	decoder->output = output;
+	decoder->output_start = output;
+	decoder->output_end = decoder->output + output_length;
+	decoder->finished = false;
+}
+
+/* Decode all sequences that are completely contained in the input up to
+ * "input_end" and return; call again once more input has arrived. A
+ * sequence is only written out once it has been parsed completely, so
+ * decoding in place (compressed data at the end of the output buffer) is
+ * safe to resume. "last_input" marks that "input_end" is the end of the
+ * block. Returns false on corrupt data. */
+bool lz4_decode(struct lz4_decoder_t *decoder, const void *input_end_ptr, bool last_input) {
+	const uint8_t *input_end = input_end_ptr;
+	while (!decoder->finished) {
+		const uint8_t *input = decoder->input;
+		if (input >= input_end) {
+			break;
+		}
+		const uint8_t token = *input++;
+
+		uint32_t literal_length = token >> 4;
+		if ((literal_length == 15) && !lz4_read_length(&input, input_end, &literal_length)) {
+			break;
+		}
+		if ((uint32_t)(input_end - input) < literal_length) {
+			break;
+		}
+		const uint8_t *literals = input;
+		input += literal_length;
+		if ((uint32_t)(decoder->output_end - decoder->output) < literal_length) {
+			return false;
+		}
+
+		if (input == input_end) {
+			/* Only the last sequence of a block has no match */
+			if (!last_input) {
+				break;
+			}
+			lz4_copy(decoder->output, literals, literal_length);
+			decoder->output += literal_length;
+			decoder->input = input;
+			decoder->finished = true;
+			break;
+		}
+
+		if (input_end - input < 2) {
+			break;
+		}
+		const uint32_t offset = input[0] | (input[1] << 8);
+		input += 2;
+		uint32_t match_length = token & 0x0f;
+		if ((match_length == 15) && !lz4_read_length(&input, input_end, &match_length)) {
+			break;
+		}
+		match_length += LZ4_MIN_MATCH;
+
+		uint8_t *match_target = decoder->output + literal_length;
+		if ((offset == 0) || (offset > (uint32_t)(match_target - decoder->output_start)) || ((uint32_t)(decoder->output_end - match_target) < match_length)) {
+			return false;
+		}
+		lz4_copy(decoder->output, literals, literal_length);
+		lz4_copy(match_target, match_target - offset, match_length);
+		decoder->output = match_target + match_length;
+		decoder->input = input;
+	}
+	return decoder->finished || !last_input;
+}
@@ -0,0 +1,66 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "longmode_example_stage1_memory.h"
+#include "longmode_example_stage1_paging.h"
+#include "longmode_example_common_string.h"
+
+static uintptr_t dma_area_next = DMA_AREA_START;
+
+uint64_t virt_to_phys(const void *ptr) {
+	uint64_t virt = (uint64_t)ptr;
+	if ((virt >= STAGE2_VIRT_BASE) && (virt < STAGE2_VIRT_BASE + paging_stage2_window_size())) {
+		return virt - STAGE2_VIRT_BASE + paging_stage2_phys_base();
+	}
+	if (virt >= PHYSMAP_BASE) {
+		return virt - PHYSMAP_BASE;
+	}
+	/* Everything else that stage1 touches is identity mapped */
+	return virt;
+}
+
+/* Hand out zeroed, identity mapped memory that devices can access by DMA.
+ * Memory is never freed. Returns NULL if the area is exhausted. */
+void *dma_alloc(size_t length, size_t alignment) {
+	uintptr_t start = (dma_area_next + alignment - 1) & ~(alignment - 1);
+	if (start + length > DMA_AREA_END) {
+		return NULL;
+	}
+	dma_area_next = start + length;
+	memset((void*)start, 0, length);
+	return (void*)start;
+}
+
+/* All physical memory below paging_mapped_limit() is mapped, and ranges
+ * outside of RAM are mapped uncached. MMIO regions are accessed through the
+ * physmap, since the identity mapping has the stage 2 window in its second
+ * GiB. */
+void *mmio_map(uint64_t phys_addr, uint64_t length) {
+	if (phys_addr + length > paging_mapped_limit()) {
+		return NULL;
+	}
+	return (void*)(PHYSMAP_BASE + phys_addr);
+}
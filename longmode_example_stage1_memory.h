@@ -0,0 +1,47 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_STAGE1_MEMORY_H__
+#define __LONGMODE_EXAMPLE_STAGE1_MEMORY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "longmode_example_common_bootinfo.h"
+
+/* Stage 2 window; its size is chosen when stage 2 is loaded, see
+ * paging_map_stage2_window() */
+#define STAGE2_VIRT_BASE			0x40000000
+#define STAGE2_WINDOW_MAX_SIZE		(1024 * 1024 * 1024)
+
+/* Identity mapped memory between stage1 and its stack at 2 MiB that holds
+ * device structures (PRD tables, command lists, page directories) */
+#define DMA_AREA_START				0x100000
+#define DMA_AREA_END				0x1c0000
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+uint64_t virt_to_phys(const void *ptr);
+void *dma_alloc(size_t length, size_t alignment);
+void *mmio_map(uint64_t phys_addr, uint64_t length);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -0,0 +1,252 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage1_paging.h"
+#include "longmode_example_stage1_memory.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_paging.h"
+#include "longmode_example_common_io.h"
+
+#define PAGE_SIZE_4K			4096ULL
+#define PAGE_SIZE_2M			(2ULL * 1024 * 1024)
+#define PAGE_SIZE_1G			(1024ULL * 1024 * 1024)
+#define FOUR_GIB				(4 * PAGE_SIZE_1G)
+#define PDPT_SPAN				(512 * PAGE_SIZE_1G)
+
+#define PML4_INDEX_PHYSMAP		((PHYSMAP_BASE >> 39) & 0x1ff)
+#define PDPT_INDEX_STAGE2		(STAGE2_VIRT_BASE / PAGE_SIZE_1G)
+
+/* Legacy VGA memory (graphics and text mode buffers) */
+#define VGA_MEMORY_START		0xa0000
+#define VGA_MEMORY_END			0xc0000
+
+static struct {
+	const struct bootinfo_t *bootinfo;
+	uint64_t *pml4;
+	uint64_t *identity_pdpt;
+	uint64_t *physmap_pdpt;
+	uint64_t *low_page_table;
+	uint64_t memory_end;			/* End of the highest memory map entry that is backed by memory */
+	uint64_t mapped_limit;
+	uint64_t stage2_phys_base;
+	uint64_t stage2_window_size;
+	uint64_t stage2_min_phys_base;
+	bool gib_pages;
+	bool pat;
+} paging;
+
+static bool e820_is_memory(const struct e820_entry_t *entry) {
+	return (entry->type == E820_TYPE_RAM) || (entry->type == E820_TYPE_ACPI) || (entry->type == E820_TYPE_NVS);
+}
+
+static bool is_memory(uint64_t phys_addr) {
+	for (unsigned int i = 0; i < paging.bootinfo->e820_count; i++) {
+		const struct e820_entry_t *entry = &paging.bootinfo->e820[i];
+		if ((phys_addr >= entry->base) && (phys_addr - entry->base < entry->length)) {
+			return e820_is_memory(entry);
+		}
+	}
+	return false;
+}
+
+/* Anything that is not backed by memory according to the memory map is
+ * assumed to be MMIO and mapped uncached. The first 2 MiB contain the legacy
+ * VGA and BIOS areas, but their caching is set by the fixed range MTRRs. */
+static uint64_t page_flags(uint64_t phys_addr) {
+	return ((phys_addr == 0) || is_memory(phys_addr)) ? (PG_PRESENT | PG_ALLOW_WRITE | PG_PS | PG_CACHE_WB) : (PG_PRESENT | PG_ALLOW_WRITE | PG_PS | PG_CACHE_UC);
+}
+
+/* A GiB can be covered by a single page if all of its 2 MiB pages would
+ * have the same attributes */
+static bool gib_is_uniform(uint64_t start) {
+	const uint64_t flags = page_flags(start);
+	for (uint64_t phys_addr = start + PAGE_SIZE_2M; phys_addr < start + PAGE_SIZE_1G; phys_addr += PAGE_SIZE_2M) {
+		if (page_flags(phys_addr) != flags) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint64_t *paging_alloc_table(void) {
+	return dma_alloc(4096, 4096);
+}
+
+/* The first 2 MiB are mapped with 4 kiB pages so that the VGA memory can be
+ * write-combining: the console only ever writes to it and WC lets the CPU
+ * merge those writes into bursts. PAT write-combining wins over the UC that
+ * the fixed range MTRRs usually set for this area. */
+static uint64_t *paging_build_low_page_table(void) {
+	uint64_t *page_table = paging_alloc_table();
+	if (!page_table) {
+		return NULL;
+	}
+	for (unsigned int i = 0; i < 512; i++) {
+		const uint64_t phys_addr = i * PAGE_SIZE_4K;
+		const bool vga_memory = (phys_addr >= VGA_MEMORY_START) && (phys_addr < VGA_MEMORY_END);
+		page_table[i] = phys_addr | PG_PRESENT | PG_ALLOW_WRITE | ((vga_memory && paging.pat) ? PG_CACHE_WC : PG_CACHE_WB);
+	}
+	return page_table;
+}
+
+static void paging_load_cr3(void) {
+	__asm__ __volatile__("mov %0, %%cr3" : : "r"(paging.pml4) : "memory");
+}
+
+/* Replace the static tables of the stage1 assembly code: physical memory up
+ * to the end of memory (at least 4 GiB, to cover the PCI hole) is identity
+ * mapped and also mapped at PHYSMAP_BASE, using 1 GiB pages where the CPU
+ * supports them and 2 MiB pages otherwise. Both mappings share their page
+ * directories; the second GiB of the identity mapping is left for the stage
+ * 2 window, so physical memory there is only reachable via the physmap. */
+bool paging_init(const struct bootinfo_t *bootinfo) {
+	paging.bootinfo = bootinfo;
+	for (unsigned int i = 0; i < bootinfo->e820_count; i++) {
+		const struct e820_entry_t *entry = &bootinfo->e820[i];
+		if (e820_is_memory(entry) && (entry->base + entry->length > paging.memory_end)) {
+			paging.memory_end = entry->base + entry->length;
+		}
+	}
+	paging.gib_pages = (cpuid(CPUID_EXT_FEATURES, 0).edx & CPUID_EXT_EDX_PDPE1GB) != 0;
+	paging.pat = (cpuid(CPUID_FEATURES, 0).edx & CPUID_EDX_PAT) != 0;
+	if (paging.pat) {
+		/* Nothing is mapped with PWT alone yet, so reprogramming entry 1
+		 * does not change the type of any existing mapping */
+		wrmsr(IA32_PAT, PAT_LAYOUT);
+	}
+	paging.mapped_limit = (paging.memory_end > FOUR_GIB) ? paging.memory_end : FOUR_GIB;
+	paging.mapped_limit = (paging.mapped_limit + PAGE_SIZE_1G - 1) & ~(PAGE_SIZE_1G - 1);
+	if (paging.mapped_limit > PDPT_SPAN) {
+		paging.mapped_limit = PDPT_SPAN;
+	}
+
+	paging.pml4 = paging_alloc_table();
+	paging.identity_pdpt = paging_alloc_table();
+	paging.physmap_pdpt = paging_alloc_table();
+	paging.low_page_table = paging_build_low_page_table();
+	if (!paging.pml4 || !paging.identity_pdpt || !paging.physmap_pdpt || !paging.low_page_table) {
+		return false;
+	}
+	for (uint64_t gib = 0; gib < paging.mapped_limit; gib += PAGE_SIZE_1G) {
+		uint64_t entry;
+		if (paging.gib_pages && (gib != 0) && gib_is_uniform(gib)) {
+			entry = gib | page_flags(gib);
+		} else {
+			uint64_t *pdir = paging_alloc_table();
+			if (!pdir) {
+				/* Out of table memory, map only what we have got so far */
+				paging.mapped_limit = gib;
+				break;
+			}
+			for (unsigned int i = 0; i < 512; i++) {
+				const uint64_t phys_addr = gib + (i * PAGE_SIZE_2M);
+				pdir[i] = phys_addr | page_flags(phys_addr);
+			}
+			if (gib == 0) {
+				pdir[0] = (uint64_t)paging.low_page_table | PG_TABLE;
+			}
+			entry = (uint64_t)pdir | PG_TABLE;
+		}
+		paging.physmap_pdpt[gib / PAGE_SIZE_1G] = entry;
+		if ((gib / PAGE_SIZE_1G) != PDPT_INDEX_STAGE2) {
+			paging.identity_pdpt[gib / PAGE_SIZE_1G] = entry;
+		}
+	}
+	paging.pml4[0] = (uint64_t)paging.identity_pdpt | PG_TABLE;
+	paging.pml4[PML4_INDEX_PHYSMAP] = (uint64_t)paging.physmap_pdpt | PG_TABLE;
+	paging_load_cr3();
+
+	printmsg("stage1: paging: memory ends at ");
+	print_uint64(paging.memory_end);
+	printmsg(", mapped up to ");
+	print_uint64(paging.mapped_limit);
+	printmsg(paging.gib_pages ? " using 1 GiB pages" : " using 2 MiB pages");
+	printmsg(paging.pat ? ", VGA memory write-combining\n" : ", no PAT support\n");
+	return true;
+}
+
+/* The lowest 2 MiB aligned, physically contiguous block of RAM above the
+ * loader that is at least "size" bytes long */
+static bool paging_find_stage2_phys_base(uint64_t size, uint64_t *phys_base) {
+	for (unsigned int i = 0; i < paging.bootinfo->e820_count; i++) {
+		const struct e820_entry_t *entry = &paging.bootinfo->e820[i];
+		if (entry->type != E820_TYPE_RAM) {
+			continue;
+		}
+		const uint64_t min_start = (paging.stage2_min_phys_base > BOOTINFO_LOADER_END) ? paging.stage2_min_phys_base : BOOTINFO_LOADER_END;
+		uint64_t start = (entry->base > min_start) ? entry->base : min_start;
+		start = (start + PAGE_SIZE_2M - 1) & ~(PAGE_SIZE_2M - 1);
+		if (start + size <= entry->base + entry->length) {
+			*phys_base = start;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Keep the stage 2 window clear of memory below "phys_addr" that is still
+ * needed while stage 2 is loaded */
+void paging_stage2_window_above(uint64_t phys_addr) {
+	if (phys_addr > paging.stage2_min_phys_base) {
+		paging.stage2_min_phys_base = phys_addr;
+	}
+}
+
+/* Map the stage 2 window at STAGE2_VIRT_BASE, just large enough for "size"
+ * bytes, to physically contiguous RAM taken from the memory map */
+bool paging_map_stage2_window(uint64_t size) {
+	size = (size + PAGE_SIZE_2M - 1) & ~(PAGE_SIZE_2M - 1);
+	if ((size > STAGE2_WINDOW_MAX_SIZE) || !paging_find_stage2_phys_base(size, &paging.stage2_phys_base)) {
+		return false;
+	}
+	uint64_t *pdir = paging_alloc_table();
+	if (!pdir) {
+		return false;
+	}
+	for (unsigned int i = 0; i < size / PAGE_SIZE_2M; i++) {
+		pdir[i] = (paging.stage2_phys_base + (i * PAGE_SIZE_2M)) | PG_PRESENT | PG_ALLOW_WRITE | PG_PS;
+	}
+	paging.identity_pdpt[PDPT_INDEX_STAGE2] = (uint64_t)pdir | PG_TABLE;
+	paging_load_cr3();
+	paging.stage2_window_size = size;
+	return true;
+}
+
+uint64_t paging_stage2_phys_base(void) {
+	return paging.stage2_phys_base;
+}
+
+/* Physical address of the page table that maps the first 2 MiB */
+uint64_t paging_low_page_table(void) {
+	return virt_to_phys(paging.low_page_table);
+}
+
+uint64_t paging_stage2_window_size(void) {
+	return paging.stage2_window_size;
+}
+
+uint64_t paging_mapped_limit(void) {
+	return paging.mapped_limit;
+}
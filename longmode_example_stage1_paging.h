@@ -0,0 +1,41 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_STAGE1_PAGING_H__
+#define __LONGMODE_EXAMPLE_STAGE1_PAGING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_common_bootinfo.h"
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+bool paging_init(const struct bootinfo_t *bootinfo);
+void paging_stage2_window_above(uint64_t phys_addr);
+bool paging_map_stage2_window(uint64_t size);
+uint64_t paging_stage2_phys_base(void);
+uint64_t paging_low_page_table(void);
+uint64_t paging_stage2_window_size(void);
+uint64_t paging_mapped_limit(void);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -0,0 +1,121 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage1_pci.h"
+#include "longmode_example_common_io.h"
+
+#define PCI_CONFIG_ADDRESS_PORT		0xcf8
+#define PCI_CONFIG_DATA_PORT		0xcfc
+
+static uint32_t pci_config_address(const struct pci_function_t *function, uint8_t offset) {
+	return (1UL << 31) | (function->bus << 16) | (function->device << 11) | (function->function << 8) | (offset & 0xfc);
+}
+
+uint32_t pci_config_read(const struct pci_function_t *function, uint8_t offset) {
+	port_out_dword(PCI_CONFIG_ADDRESS_PORT, pci_config_address(function, offset));
+	return port_in_dword(PCI_CONFIG_DATA_PORT);
+}
+
+void pci_config_write(const struct pci_function_t *function, uint8_t offset, uint32_t value) {
+	port_out_dword(PCI_CONFIG_ADDRESS_PORT, pci_config_address(function, offset));
+	port_out_dword(PCI_CONFIG_DATA_PORT, value);
+}
+
+/* Scan all buses for the first function that the match callback accepts */
+static bool pci_scan(bool (*match)(const struct pci_function_t *function, uint32_t vendor_device, uint32_t class_reg, const void *ctx), const void *ctx, struct pci_function_t *result) {
+	for (unsigned int bus = 0; bus < 256; bus++) {
+		for (unsigned int device = 0; device < 32; device++) {
+			unsigned int function_count = 1;
+			for (unsigned int function = 0; function < function_count; function++) {
+				struct pci_function_t candidate = {
+					.bus = bus,
+					.device = device,
+					.function = function,
+				};
+				uint32_t vendor_device = pci_config_read(&candidate, PCI_REG_VENDOR_DEVICE);
+				if ((vendor_device & 0xffff) == 0xffff) {
+					continue;
+				}
+				if ((function == 0) && (pci_config_read(&candidate, PCI_REG_HEADER_TYPE) & (1 << 23))) {
+					/* Multi-function device */
+					function_count = 8;
+				}
+				if (match(&candidate, vendor_device, pci_config_read(&candidate, PCI_REG_CLASS), ctx)) {
+					*result = candidate;
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+struct pci_class_match_t {
+	uint16_t class_subclass;
+	uint8_t progif_mask;
+};
+
+static bool pci_match_class(const struct pci_function_t *function, uint32_t vendor_device, uint32_t class_reg, const void *ctx) {
+	const struct pci_class_match_t *class_match = (const struct pci_class_match_t*)ctx;
+	uint8_t progif = (class_reg >> 8) & 0xff;
+	return ((class_reg >> 16) == class_match->class_subclass) && ((progif & class_match->progif_mask) == class_match->progif_mask);
+}
+
+static bool pci_match_device(const struct pci_function_t *function, uint32_t vendor_device, uint32_t class_reg, const void *ctx) {
+	return vendor_device == *(const uint32_t*)ctx;
+}
+
+/* Find the first function with the given class/subclass whose programming
+ * interface has all bits of progif_mask set. */
+bool pci_find_class(uint16_t class_subclass, uint8_t progif_mask, struct pci_function_t *result) {
+	const struct pci_class_match_t class_match = {
+		.class_subclass = class_subclass,
+		.progif_mask = progif_mask,
+	};
+	return pci_scan(pci_match_class, &class_match, result);
+}
+
+bool pci_find_device(uint16_t vendor_id, uint16_t device_id, struct pci_function_t *result) {
+	const uint32_t vendor_device = ((uint32_t)device_id << 16) | vendor_id;
+	return pci_scan(pci_match_device, &vendor_device, result);
+}
+
+void pci_enable(const struct pci_function_t *function, uint16_t command_flags) {
+	uint32_t command = pci_config_read(function, PCI_REG_COMMAND) & 0xffff;
+	pci_config_write(function, PCI_REG_COMMAND, command | command_flags);
+}
+
+/* Returns the base address of a memory BAR (32 or 64 bit) or of an I/O BAR */
+uint64_t pci_bar_address(const struct pci_function_t *function, unsigned int bar) {
+	uint32_t bar_value = pci_config_read(function, PCI_REG_BAR0 + (4 * bar));
+	if (bar_value & PCI_BAR_IO) {
+		return bar_value & ~0x3UL;
+	}
+	uint64_t address = bar_value & ~0xfUL;
+	if ((bar_value & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64BIT) {
+		address |= (uint64_t)pci_config_read(function, PCI_REG_BAR0 + (4 * (bar + 1))) << 32;
+	}
+	return address;
+}
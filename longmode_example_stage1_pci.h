@@ -0,0 +1,62 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_STAGE1_PCI_H__
+#define __LONGMODE_EXAMPLE_STAGE1_PCI_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PCI_REG_VENDOR_DEVICE		0x00
+#define PCI_REG_COMMAND				0x04
+#define PCI_REG_CLASS				0x08
+#define PCI_REG_HEADER_TYPE			0x0c
+#define PCI_REG_BAR0				0x10
+
+#define PCI_COMMAND_IO_SPACE		(1 << 0)
+#define PCI_COMMAND_MEMORY_SPACE	(1 << 1)
+#define PCI_COMMAND_BUS_MASTER		(1 << 2)
+
+#define PCI_BAR_IO					(1 << 0)
+#define PCI_BAR_TYPE_MASK			(3 << 1)
+#define PCI_BAR_TYPE_64BIT			(2 << 1)
+
+#define PCI_CLASS_IDE				0x0101
+#define PCI_CLASS_SATA				0x0106
+
+struct pci_function_t {
+	uint8_t bus;
+	uint8_t device;
+	uint8_t function;
+};
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+uint32_t pci_config_read(const struct pci_function_t *function, uint8_t offset);
+void pci_config_write(const struct pci_function_t *function, uint8_t offset, uint32_t value);
+bool pci_find_class(uint16_t class_subclass, uint8_t progif_mask, struct pci_function_t *result);
+bool pci_find_device(uint16_t vendor_id, uint16_t device_id, struct pci_function_t *result);
+void pci_enable(const struct pci_function_t *function, uint16_t command_flags);
+uint64_t pci_bar_address(const struct pci_function_t *function, unsigned int bar);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
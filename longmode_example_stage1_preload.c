@@ -0,0 +1,107 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage1_preload.h"
+#include "longmode_example_stage1_blockdev.h"
+#include "longmode_example_stage1_loader.h"
+#include "longmode_example_stage1_memory.h"
+#include "longmode_example_stage1_paging.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_bootinfo.h"
+#include "longmode_example_common_io.h"
+#include "longmode_example_common_string.h"
+
+#define MBR_ADDR				0x7c00
+
+/* Partition 2 as copied to high memory by the stage 0 unreal mode loader.
+ * LBA 0 is served from the MBR that the BIOS loaded, so the rest of stage 1
+ * treats this like any other disk. */
+static struct {
+	const struct mbr_t *mbr;
+	const uint8_t *data;
+	uint64_t lba_start;
+	uint32_t length_sectors;
+} preload;
+
+static bool preload_read_sectors(uint64_t lba, uint32_t sector_count, void *target) {
+	if ((lba == 0) && (sector_count == 1)) {
+		memcpy(target, preload.mbr, BLOCKDEV_SECTOR_SIZE);
+		return true;
+	}
+	if ((lba < preload.lba_start) || (lba + sector_count > preload.lba_start + preload.length_sectors)) {
+		return false;
+	}
+	memcpy(target, preload.data + (BLOCKDEV_SECTOR_SIZE * (lba - preload.lba_start)), BLOCKDEV_SECTOR_SIZE * sector_count);
+	return true;
+}
+
+static bool preload_read_wait(void) {
+	return true;
+}
+
+static const char *preload_transfer_name(void) {
+	return "memcpy from stage 0";
+}
+
+bool preload_probe(struct blockdev_t *blockdev) {
+	/* Consume the address, a later warm boot with the plain EDD loader
+	 * must not find it again */
+	volatile uint32_t *info = (volatile uint32_t*)low_memory(STAGE0_PRELOAD_INFO_ADDR);
+	const uint64_t phys_addr = *info;
+	*info = 0;
+	if (phys_addr != STAGE0_PRELOAD_ADDR) {
+		return false;
+	}
+
+	preload.mbr = (const struct mbr_t*)low_memory(MBR_ADDR);
+	if (preload.mbr->mbr_signature != MBR_SIGNATURE) {
+		return false;
+	}
+	preload.lba_start = preload.mbr->partition[1].lba_start;
+	preload.length_sectors = preload.mbr->partition[1].length_sectors;
+
+	/* RAM outside the first GiB is only reachable through the physmap */
+	preload.data = mmio_map(phys_addr, (uint64_t)BLOCKDEV_SECTOR_SIZE * preload.length_sectors);
+	if (!preload.data || (preload.length_sectors == 0) || (((const struct stage2_header_t*)preload.data)->magic != STAGE2_HEADER_MAGIC)) {
+		return false;
+	}
+	paging_stage2_window_above(phys_addr + ((uint64_t)BLOCKDEV_SECTOR_SIZE * preload.length_sectors));
+
+	printmsg("stage1: stage 2 preloaded by stage 0 at ");
+	print_uint64(phys_addr);
+	printmsg(", ");
+	print_decimal(preload.length_sectors);
+	printmsg(" sectors\n");
+
+	*blockdev = (struct blockdev_t) {
+		.name = "preload",
+		.sector_count = preload.lba_start + preload.length_sectors,
+		.read = preload_read_sectors,
+		.read_start = preload_read_sectors,
+		.read_wait = preload_read_wait,
+		.transfer_name = preload_transfer_name,
+	};
+	return true;
+}
@@ -0,0 +1,356 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage1_virtio.h"
+#include "longmode_example_stage1_blockdev.h"
+#include "longmode_example_common_io.h"
+#include "longmode_example_stage1_pci.h"
+#include "longmode_example_stage1_memory.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_tsc.h"
+
+/* Only the legacy (transitional) PCI interface is supported, which QEMU
+ * offers by default for virtio devices on a conventional PCI bus */
+#define VIRTIO_PCI_VENDOR_ID		0x1af4
+#define VIRTIO_PCI_DEVICE_BLK		0x1001
+#define VIRTIO_PCI_IO_BAR			0
+
+/* Legacy virtio registers, relative to BAR0 */
+#define VIRTIO_REG_DEVICE_FEATURES	0x00
+#define VIRTIO_REG_GUEST_FEATURES	0x04
+#define VIRTIO_REG_QUEUE_PFN		0x08
+#define VIRTIO_REG_QUEUE_SIZE		0x0c
+#define VIRTIO_REG_QUEUE_SELECT		0x0e
+#define VIRTIO_REG_QUEUE_NOTIFY		0x10
+#define VIRTIO_REG_DEVICE_STATUS	0x12
+#define VIRTIO_REG_ISR_STATUS		0x13
+#define VIRTIO_REG_BLK_CAPACITY		0x14
+#define VIRTIO_REG_BLK_SIZE_MAX		0x1c
+#define VIRTIO_REG_BLK_SEG_MAX		0x20
+
+#define VIRTIO_STATUS_ACKNOWLEDGE	(1 << 0)
+#define VIRTIO_STATUS_DRIVER		(1 << 1)
+#define VIRTIO_STATUS_DRIVER_OK		(1 << 2)
+#define VIRTIO_STATUS_FAILED		(1 << 7)
+
+#define VIRTIO_BLK_F_SIZE_MAX		(1 << 1)
+#define VIRTIO_BLK_F_SEG_MAX		(1 << 2)
+
+#define VIRTIO_BLK_T_IN				0
+#define VIRTIO_BLK_S_OK				0
+
+#define VIRTQ_DESC_F_NEXT			(1 << 0)
+#define VIRTQ_DESC_F_WRITE			(1 << 1)
+#define VIRTQ_AVAIL_F_NO_INTERRUPT	(1 << 0)
+#define VIRTQ_ALIGN					4096
+
+/* Each request is one descriptor chain: header, up to VIRTIO_BLK_MAX_SEGMENTS
+ * data descriptors directly into the target buffer and the status byte.
+ * Several requests are kept in flight at once. */
+#define VIRTIO_BLK_MAX_SEGMENTS		8
+#define VIRTIO_BLK_MAX_SEGMENT_SIZE	(4 * 1024 * 1024)
+#define VIRTIO_BLK_MAX_REQUESTS		8
+#define VIRTIO_BLK_DESC_PER_REQUEST	(VIRTIO_BLK_MAX_SEGMENTS + 2)
+#define VIRTIO_BLK_TIMEOUT_MS		5000
+
+struct virtq_desc_t {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+} __attribute__ ((packed));
+
+struct virtq_avail_t {
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[];
+} __attribute__ ((packed));
+
+struct virtq_used_elem_t {
+	uint32_t id;
+	uint32_t len;
+} __attribute__ ((packed));
+
+struct virtq_used_t {
+	uint16_t flags;
+	uint16_t idx;
+	struct virtq_used_elem_t ring[];
+} __attribute__ ((packed));
+
+struct virtio_blk_req_header_t {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t sector;
+} __attribute__ ((packed));
+
+static struct {
+	uint16_t io_base;
+	uint64_t sector_count;
+	uint16_t queue_size;
+	uint16_t avail_idx;
+	uint16_t used_idx;
+	unsigned int max_segments;
+	uint32_t max_segment_size;
+	unsigned int max_requests;
+	struct virtq_desc_t *desc;
+	volatile struct virtq_avail_t *avail;
+	volatile struct virtq_used_t *used;
+	struct virtio_blk_req_header_t *headers;
+	volatile uint8_t *status;
+	bool failed;					/* Reset after a timeout, all reads fail */
+} virtio_blk;
+
+/* The read that read_start() issued and read_wait() completes */
+static struct {
+	uint64_t lba;
+	uint32_t remaining_sectors;
+	void *target;
+	uint32_t free_slots;
+	bool success;
+} virtio_blk_request;
+
+static void compiler_barrier(void) {
+	__asm__ __volatile__("" : : : "memory");
+}
+
+static bool virtio_blk_queue_init(void) {
+	port_out_word(virtio_blk.io_base + VIRTIO_REG_QUEUE_SELECT, 0);
+	virtio_blk.queue_size = port_in_word(virtio_blk.io_base + VIRTIO_REG_QUEUE_SIZE);
+	if (virtio_blk.queue_size < VIRTIO_BLK_DESC_PER_REQUEST) {
+		return false;
+	}
+
+	/* Legacy layout: descriptor table and available ring, then the used ring
+	 * on the next VIRTQ_ALIGN boundary */
+	const unsigned int n = virtio_blk.queue_size;
+	const uint32_t avail_offset = sizeof(struct virtq_desc_t) * n;
+	const uint32_t used_offset = (avail_offset + sizeof(struct virtq_avail_t) + (2 * (n + 1)) + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1);
+	const uint32_t queue_length = used_offset + sizeof(struct virtq_used_t) + (sizeof(struct virtq_used_elem_t) * n) + 2;
+	uint8_t *queue = dma_alloc(queue_length, VIRTQ_ALIGN);
+	virtio_blk.headers = dma_alloc(VIRTIO_BLK_MAX_REQUESTS * sizeof(struct virtio_blk_req_header_t), 16);
+	virtio_blk.status = dma_alloc(VIRTIO_BLK_MAX_REQUESTS, 16);
+	if (!queue || !virtio_blk.headers || !virtio_blk.status) {
+		return false;
+	}
+	virtio_blk.desc = (struct virtq_desc_t*)queue;
+	virtio_blk.avail = (volatile struct virtq_avail_t*)(queue + avail_offset);
+	virtio_blk.used = (volatile struct virtq_used_t*)(queue + used_offset);
+	virtio_blk.avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+	virtio_blk.max_requests = n / VIRTIO_BLK_DESC_PER_REQUEST;
+	if (virtio_blk.max_requests > VIRTIO_BLK_MAX_REQUESTS) {
+		virtio_blk.max_requests = VIRTIO_BLK_MAX_REQUESTS;
+	}
+	port_out_dword(virtio_blk.io_base + VIRTIO_REG_QUEUE_PFN, virt_to_phys(queue) / VIRTQ_ALIGN);
+	return true;
+}
+
+/* Put one request into descriptor chain "slot" and publish it in the
+ * available ring. The device is only notified by the caller, so that several
+ * requests are handed over with a single register write. */
+static void virtio_blk_submit(unsigned int slot, uint64_t lba, void *target, uint32_t length) {
+	struct virtq_desc_t *desc = &virtio_blk.desc[slot * VIRTIO_BLK_DESC_PER_REQUEST];
+	unsigned int desc_index = 0;
+
+	virtio_blk.headers[slot] = (struct virtio_blk_req_header_t) {
+		.type = VIRTIO_BLK_T_IN,
+		.sector = lba,
+	};
+	virtio_blk.status[slot] = 0xff;
+	desc[desc_index++] = (struct virtq_desc_t) {
+		.addr = virt_to_phys(&virtio_blk.headers[slot]),
+		.len = sizeof(struct virtio_blk_req_header_t),
+		.flags = VIRTQ_DESC_F_NEXT,
+	};
+
+	uint64_t phys_addr = virt_to_phys(target);
+	while (length > 0) {
+		uint32_t chunk = (length < virtio_blk.max_segment_size) ? length : virtio_blk.max_segment_size;
+		desc[desc_index++] = (struct virtq_desc_t) {
+			.addr = phys_addr,
+			.len = chunk,
+			.flags = VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE,
+		};
+		phys_addr += chunk;
+		length -= chunk;
+	}
+
+	desc[desc_index++] = (struct virtq_desc_t) {
+		.addr = virt_to_phys((const void*)&virtio_blk.status[slot]),
+		.len = 1,
+		.flags = VIRTQ_DESC_F_WRITE,
+	};
+	for (unsigned int i = 0; i < desc_index - 1; i++) {
+		desc[i].next = (slot * VIRTIO_BLK_DESC_PER_REQUEST) + i + 1;
+	}
+
+	virtio_blk.avail->ring[virtio_blk.avail_idx % virtio_blk.queue_size] = slot * VIRTIO_BLK_DESC_PER_REQUEST;
+	compiler_barrier();
+	virtio_blk.avail_idx++;
+	virtio_blk.avail->idx = virtio_blk.avail_idx;
+}
+
+/* Fill free descriptor chains with the rest of the current request, then
+ * notify the device once for all of them */
+static void virtio_blk_submit_pending(void) {
+	const uint32_t max_request_sectors = (virtio_blk.max_segments * virtio_blk.max_segment_size) / BLOCKDEV_SECTOR_SIZE;
+	bool submitted = false;
+	while ((virtio_blk_request.remaining_sectors > 0) && virtio_blk_request.free_slots) {
+		unsigned int slot = __builtin_ctz(virtio_blk_request.free_slots);
+		uint32_t chunk_sectors = (virtio_blk_request.remaining_sectors < max_request_sectors) ? virtio_blk_request.remaining_sectors : max_request_sectors;
+		virtio_blk_submit(slot, virtio_blk_request.lba, virtio_blk_request.target, BLOCKDEV_SECTOR_SIZE * chunk_sectors);
+		virtio_blk_request.free_slots &= ~(1UL << slot);
+		submitted = true;
+
+		virtio_blk_request.target += BLOCKDEV_SECTOR_SIZE * chunk_sectors;
+		virtio_blk_request.lba += chunk_sectors;
+		virtio_blk_request.remaining_sectors -= chunk_sectors;
+	}
+	if (submitted) {
+		compiler_barrier();
+		port_out_word(virtio_blk.io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+	}
+}
+
+static bool virtio_blk_read_start(uint64_t start_lba, uint32_t length_sectors, void *target) {
+	if (virtio_blk.failed || ((start_lba + length_sectors) > virtio_blk.sector_count)) {
+		return false;
+	}
+	virtio_blk_request.lba = start_lba;
+	virtio_blk_request.remaining_sectors = length_sectors;
+	virtio_blk_request.target = target;
+	virtio_blk_request.free_slots = (1UL << virtio_blk.max_requests) - 1;
+	virtio_blk_request.success = true;
+	virtio_blk_submit_pending();
+	return true;
+}
+
+/* The timeout restarts with every completion, so it bounds a single
+ * request and not the whole read */
+static bool virtio_blk_read_wait(void) {
+	const uint32_t all_slots = (1UL << virtio_blk.max_requests) - 1;
+	while (virtio_blk_request.free_slots != all_slots) {
+		/* Poll the used ring for completed chains */
+		const uint64_t deadline = deadline_ns(VIRTIO_BLK_TIMEOUT_MS * 1000000ULL);
+		while (virtio_blk.used_idx == virtio_blk.used->idx) {
+			if (deadline_expired(deadline)) {
+				/* Only a reset makes the device let go of the buffers, which
+				 * leaves the virtqueue unusable */
+				port_out(virtio_blk.io_base + VIRTIO_REG_DEVICE_STATUS, 0);
+				virtio_blk.failed = true;
+				printmsg("stage1: virtio-blk: request timed out, device reset\n");
+				return false;
+			}
+			cpu_relax();
+		}
+		compiler_barrier();
+		while (virtio_blk.used_idx != virtio_blk.used->idx) {
+			unsigned int slot = virtio_blk.used->ring[virtio_blk.used_idx % virtio_blk.queue_size].id / VIRTIO_BLK_DESC_PER_REQUEST;
+			if (virtio_blk.status[slot] != VIRTIO_BLK_S_OK) {
+				virtio_blk_request.success = false;
+			}
+			virtio_blk_request.free_slots |= 1UL << slot;
+			virtio_blk.used_idx++;
+		}
+		if (!virtio_blk_request.success) {
+			/* Stop submitting, but drain what is still in flight */
+			virtio_blk_request.remaining_sectors = 0;
+		}
+		virtio_blk_submit_pending();
+	}
+	return virtio_blk_request.success;
+}
+
+static bool virtio_blk_read_sectors(uint64_t start_lba, uint32_t length_sectors, void *target) {
+	return virtio_blk_read_start(start_lba, length_sectors, target) && virtio_blk_read_wait();
+}
+
+static const char *virtio_blk_transfer_name(void) {
+	return "virtio-blk";
+}
+
+bool virtio_blk_probe(struct blockdev_t *blockdev) {
+	struct pci_function_t function;
+	if (!pci_find_device(VIRTIO_PCI_VENDOR_ID, VIRTIO_PCI_DEVICE_BLK, &function)) {
+		return false;
+	}
+	if ((pci_config_read(&function, PCI_REG_BAR0 + (4 * VIRTIO_PCI_IO_BAR)) & PCI_BAR_IO) == 0) {
+		return false;
+	}
+	virtio_blk.io_base = pci_bar_address(&function, VIRTIO_PCI_IO_BAR);
+	pci_enable(&function, PCI_COMMAND_IO_SPACE | PCI_COMMAND_BUS_MASTER);
+
+	const uint16_t io_base = virtio_blk.io_base;
+	port_out(io_base + VIRTIO_REG_DEVICE_STATUS, 0);
+	port_out(io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+	port_out(io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+	/* The only features accepted are the ones that limit request sizes */
+	const uint32_t features = port_in_dword(io_base + VIRTIO_REG_DEVICE_FEATURES) & (VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX);
+	port_out_dword(io_base + VIRTIO_REG_GUEST_FEATURES, features);
+	virtio_blk.sector_count = ((uint64_t)port_in_dword(io_base + VIRTIO_REG_BLK_CAPACITY + 4) << 32) | port_in_dword(io_base + VIRTIO_REG_BLK_CAPACITY);
+	virtio_blk.max_segment_size = VIRTIO_BLK_MAX_SEGMENT_SIZE;
+	if (features & VIRTIO_BLK_F_SIZE_MAX) {
+		uint32_t size_max = port_in_dword(io_base + VIRTIO_REG_BLK_SIZE_MAX) & ~(BLOCKDEV_SECTOR_SIZE - 1);
+		if (size_max && (size_max < virtio_blk.max_segment_size)) {
+			virtio_blk.max_segment_size = size_max;
+		}
+	}
+	virtio_blk.max_segments = VIRTIO_BLK_MAX_SEGMENTS;
+	if (features & VIRTIO_BLK_F_SEG_MAX) {
+		uint32_t seg_max = port_in_dword(io_base + VIRTIO_REG_BLK_SEG_MAX);
+		if (seg_max && (seg_max < virtio_blk.max_segments)) {
+			virtio_blk.max_segments = seg_max;
+		}
+	}
+
+	if (!virtio_blk_queue_init()) {
+		port_out(io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+		printmsg("stage1: virtio-blk: virtqueue initialization failed\n");
+		return false;
+	}
+	port_out(io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+	printmsg("stage1: virtio-blk: ");
+	print_decimal(virtio_blk.sector_count);
+	printmsg(" sectors, queue size ");
+	print_decimal(virtio_blk.queue_size);
+	printmsg(", ");
+	print_decimal(virtio_blk.max_requests);
+	printmsg(" requests of ");
+	print_decimal(virtio_blk.max_segments);
+	printmsg(" segments in flight\n");
+
+	*blockdev = (struct blockdev_t) {
+		.name = "virtio-blk",
+		.sector_count = virtio_blk.sector_count,
+		.max_transfer_sectors = virtio_blk.max_requests * ((virtio_blk.max_segments * virtio_blk.max_segment_size) / BLOCKDEV_SECTOR_SIZE),
+		.read = virtio_blk_read_sectors,
+		.read_start = virtio_blk_read_start,
+		.read_wait = virtio_blk_read_wait,
+		.transfer_name = virtio_blk_transfer_name,
+	};
+	return true;
+}
@@ -23,28 +23,59 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-
-static void cursor_newline(void);
-static void printmsg(const char *message);
-static void print_byte(uint8_t byte);
-
-static volatile uint16_t *const screen_base = (volatile uint16_t*)0xb8000;
-static struct {
-	unsigned int x, y;
-} cursor;
-
-static uint8_t port_in(unsigned int address) {
-	uint8_t value;
-	__asm__ __volatile__("inb (%%dx), %%al" : "=a"(value) : "d"(address));
-	return value;
-}
+#include "longmode_example_common_bootinfo.h"
+#include "longmode_example_common_io.h"
+#include "longmode_example_common_tsc.h"
+#include "longmode_example_common_trace.h"
+#include "longmode_example_common_serial.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_cpu.h"
+#include "longmode_example_stage2_frame.h"
+#include "longmode_example_stage2_vgabench.h"
+#include "longmode_example_stage2_smp.h"
+#include "longmode_example_stage2_sched.h"
+#include "longmode_example_stage2_schedbench.h"
+#include "longmode_example_stage2_memzero.h"
+#include "longmode_example_stage2_interrupt.h"
+
+/* Zeroed at startup, once all CPUs are running */
+#define STAGE2_HEAP_SIZE		(64 * 1024 * 1024)
+
+/* QEMU's isa-debug-exit device as configured by "build --bench"; writing
+ * value v terminates QEMU with exit status (v << 1) | 1 */
+#define QEMU_DEBUG_EXIT_PORT	0xf4
+
+/* Provided by stage2.ld */
+extern uint8_t _bss[];
+extern uint8_t _bss_end[];
 
 static bool is_key_pressed(void){
 	return port_in(0x64) & (1 << 0);
 }
 
+static bool timer_running;
+
+/* With the timer running, poll the keyboard once per tick only */
 static void wait_until_key_pressed(void) {
-	while (!is_key_pressed());
+	while (!is_key_pressed()) {
+		if (timer_running) {
+			__asm__ __volatile__("hlt");
+		} else {
+			cpu_relax();
+		}
+	}
+}
+
+/* What vectorized code paths can dispatch on, see cpu_has() */
+static void print_cpu_features(void) {
+	const uint32_t features = cpu_features();
+	printmsg("stage2: CPU features");
+	for (unsigned int bit = 0; cpu_feature_name(bit); bit++) {
+		if (features & (1 << bit)) {
+			printfmt(" %s", cpu_feature_name(bit));
+		}
+	}
+	printmsg("\n");
 }
 
 static uint8_t read_pressed_key(void) {
@@ -55,106 +86,85 @@ static uint8_t read_pressed_key(void) {
 static void monitor_keypresses(void) {
 	while (true) {
 		uint8_t key = read_pressed_key();
-		printmsg("stage2: keypress ");
-		print_byte(key);
-		printmsg(" (");
-		if (key & 0x80) {
-			printmsg("up");
-		} else {
-			printmsg("down");
-		}
-		printmsg(" ");
-		print_byte(key & ~0x80);
-		printmsg(")\n");
+		printfmt("stage2: keypress %02x (%s %02x)\n", key, (key & 0x80) ? "up" : "down", key & ~0x80);
 	}
 }
 
-static void print_char_at(int x, int y, uint8_t color, uint8_t character) {
-	volatile uint16_t *screen_pos = screen_base + (80 * y) + x;
-	*screen_pos = (color << 8) | character;
-}
-
-static void print_char(uint8_t color, uint8_t character) {
-	print_char_at(cursor.x, cursor.y, color, character);
-	cursor.x = (cursor.x + 1) % 80;
-	if (cursor.x == 0) {
-		cursor_newline();
+/* Zero the heap on all CPUs, --microbench compares against the BSP alone */
+static void heap_init(void) {
+	const uint64_t heap = frame_alloc(STAGE2_HEAP_SIZE / FRAME_SIZE);
+	if (!heap) {
+		printmsg("stage2: not enough memory for the heap\n");
+		return;
 	}
-}
-
-static void fillscr(uint8_t color, char fillchar) {
-	for (int y = 0; y < 25; y++) {
-		for (int x = 0; x < 80; x++) {
-			print_char_at(x, y, color, fillchar);
-		}
+	void *heap_start = (void*)(PHYSMAP_BASE + heap);
+	uint64_t serial_cycles = 0;
+	if (MICROBENCH) {
+		const uint64_t t_start = rdtsc();
+		memzero(heap_start, STAGE2_HEAP_SIZE);
+		serial_cycles = rdtsc() - t_start;
 	}
-	cursor.x = 0;
-	cursor.y = 0;
-}
+	const uint64_t t_start = rdtsc();
+	memzero_parallel(heap_start, STAGE2_HEAP_SIZE);
+	const uint64_t parallel_cycles = rdtsc() - t_start;
 
-static void clrscr(void) {
-	fillscr(7, ' ');
-}
-
-static void cursor_newline(void) {
-	cursor.x = 0;
-	cursor.y = (cursor.y + 1) % 25;
-	if (cursor.y == 0) {
-		clrscr();
+	if (MICROBENCH) {
+		printfmt("stage2: zeroed %u MiB heap in %lu cycles on 1 CPU, %lu cycles on %u\n", STAGE2_HEAP_SIZE / (1024 * 1024), serial_cycles, parallel_cycles, smp_cpu_count());
+	} else {
+		printfmt("stage2: zeroed %u MiB heap in %lu cycles on %u CPUs\n", STAGE2_HEAP_SIZE / (1024 * 1024), parallel_cycles, smp_cpu_count());
 	}
 }
 
-static void printmsg(const char *message) {
-	while (*message) {
-		if (*message == '\n') {
-			cursor_newline();
-		} else {
-			print_char(0x07, *message);
-		}
-		message++;
+int stage2_main(const struct bootinfo_t *bootinfo) {
+	if (bootinfo->trace_buffer) {
+		trace_attach((void*)(PHYSMAP_BASE + bootinfo->trace_buffer));
 	}
-}
-
-static void print_nibble(uint8_t nibble) {
-	nibble &= 0x0f;
-	if (nibble < 10) {
-		print_char(0x07, '0' + nibble);
-	} else {
-		print_char(0x07, 'a' + nibble - 10);
+	trace_event(TRACE_STAGE2_MAIN, 0);
+	if (bootinfo->serial_ring) {
+		serial_attach((void*)(PHYSMAP_BASE + bootinfo->serial_ring));
 	}
-}
+	console_init();
+	tsc_set_frequency(bootinfo->tsc_hz);
+	interrupt_init();
 
-static void print_byte(uint8_t byte) {
-	print_nibble(byte >> 4);
-	print_nibble(byte >> 0);
-}
+	printfmt("stage2: successfully initialized %lu ms after reset. Application now running.\n", now_ns() / 1000000);
 
-static void print_int32(uint32_t integer) {
-	print_byte(integer >> 24);
-	print_byte(integer >> 16);
-	print_byte(integer >> 8);
-	print_byte(integer >> 0);
-}
+	printfmt("stage2: address of stage2_main(): %p\n", stage2_main);
+	print_cpu_features();
 
-static void print_uint64(uint64_t integer) {
-	print_int32(integer >> 32);
-	print_int32(integer >> 0);
-}
-
-int stage2_main(void) {
-	cursor.y = 8;
-
-	printmsg("stage2: successfully initialized. Application now running.\n");
-
-	printmsg("stage2: address of stage2_main(): 0x");
-	print_uint64((uint64_t)stage2_main);
-	printmsg("\n");
+	if (!frame_init(bootinfo)) {
+		printmsg("stage2: no memory for the frame allocator\n");
+		return 0;
+	}
+	printfmt("stage2: %lu MiB of free physical memory\n", frame_free_count() * FRAME_SIZE / (1024 * 1024));
+	if (MICROBENCH) {
+		vgabench_run(bootinfo);
+	}
+	smp_init();
+	sched_init();
+	heap_init();
+	if (MICROBENCH) {
+		schedbench_run();
+	}
+	/* Nothing runs in parallel from here on: the scheduler workers return
+	 * and the APs halt instead of polling for tasks */
+	sched_set_workers(1);
+	timer_running = timer_init();
+	trace_event(TRACE_STAGE2_INITIALIZED, 0);
+	trace_dump(tsc_frequency());
+	if (bootinfo->boot_flags & BOOT_FLAG_EXIT_WHEN_INITIALIZED) {
+		serial_flush();
+		port_out(QEMU_DEBUG_EXIT_PORT, 0);
+		printmsg("stage2: isa-debug-exit not present, continuing\n");
+	}
 
 	monitor_keypresses();
 	return 0;
 }
 
-/* Vector table only has one entry, which points to main() */
-int (*stage2_ivt[])(void) __attribute__ ((section (".ivt"))) = {
-	stage2_main,
-};
+/* ELF entry point. Stage 1 does not clear .bss, so this has to happen
+ * before anything else; .bss is small enough to be cleared on the BSP. */
+__attribute__ ((section(".early"))) int stage2_start(const struct bootinfo_t *bootinfo) {
+	memzero(_bss, _bss_end - _bss);
+	return stage2_main(bootinfo);
+}
@@ -0,0 +1,146 @@
+#	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+#	Copyright (C) 2023-2023 Johannes Bauer
+#
+#	This file is part of toy_x64_bootloader.
+#
+#	toy_x64_bootloader is free software; you can redistribute it and/or modify
+#	it under the terms of the GNU General Public License as published by
+#	the Free Software Foundation; this program is ONLY licensed under
+#	version 3 of the License, later versions are explicitly excluded.
+#
+#	toy_x64_bootloader is distributed in the hope that it will be useful,
+#	but WITHOUT ANY WARRANTY; without even the implied warranty of
+#	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#	GNU General Public License for more details.
+#
+#	You should have received a copy of the GNU General Public License
+#	along with toy_x64_bootloader; if not, write to the Free Software
+#	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+#	Johannes Bauer <JohannesBauer@gmx.de>
+
+# Application processor trampoline. The SIPI starts an AP in real mode at
+# TRAMPOLINE_BASE, so smp_init() copies everything between trampoline_start
+# and trampoline_end there and fills in the parameter block at its end (see
+# struct trampoline_params_t) before each start. The AP then takes the same
+# way into long mode as main32 of stage 1, including the SSE and AVX setup,
+# but with the final page tables.
+
+.equ TRAMPOLINE_BASE,		0x1000			# Must match longmode_example_stage2_smp.h
+
+# Vol 3A 5-3 5.2 Fields and flags used for segment-level and page-level protection, pg. 3158
+.equ SD_L,					(1 << 21)		# 64 bit segment
+.equ SD_DB,					(1 << 22)		# Default operation size (set = 32-bit segment)
+.equ SD_G,					(1 << 23)		# Granularity (0 = 1 byte, 1 = 4 kiB)
+.equ SD_P,					(1 << 15)		# Segment present
+.equ SD_S,					(1 << 12)		# Descriptor type (0 = system, 1 = code/data)
+.equ SD_TYPE_DS,			(0 << 11)		# Segment type for data segment
+.equ SD_TYPE_DS_W,			(1 << 9)		# Segment type for data segment: writable
+.equ SD_TYPE_CS,			(1 << 11)		# Segment type for code segment
+.equ SD_TYPE_CS_R,			(1 << 9)		# Segment type for code segment: readable
+.equ SD_SEGTYPE_CODE_RX,	(SD_S | SD_TYPE_CS | SD_TYPE_CS_R)
+.equ SD_SEGTYPE_DATA_RW,	(SD_S | SD_TYPE_DS | SD_TYPE_DS_W)
+
+.include "longmode_example_common_simd.inc"
+
+.equ CR4_PAE,				(1 << 5)
+
+.macro segment_descriptor base, limit, flags
+	.long (\limit & 0xffff) | ((\base & 0xffff) << 16)
+	.long (\flags) | (\base & 0xff000000) | ((\base & 0x00ff0000) >> 16) | (\limit & 0xf0000)
+.endm
+
+.section .rodata.trampoline, "a"
+
+.globl trampoline_start
+.globl trampoline_end
+.globl trampoline_params
+
+.code16
+trampoline_start:
+	cli
+	cld
+	xor %ax, %ax
+	mov %ax, %ds
+
+	lgdtl TRAMPOLINE_BASE + (trampoline_gdt_desc - trampoline_start)
+	mov %cr0, %eax
+	or $1, %eax
+	mov %eax, %cr0
+	ljmpl $24, $TRAMPOLINE_BASE + (trampoline_32 - trampoline_start)
+
+.code32
+trampoline_32:
+	mov $16, %ax
+	mov %ax, %ds
+	mov %ax, %es
+	mov %ax, %ss
+
+	enable_simd
+
+	# Enable PAE
+	mov %cr4, %eax
+	or $CR4_PAE, %eax
+	mov %eax, %cr4
+
+	# Load %cr3 with the PML4 of the BSP
+	mov TRAMPOLINE_BASE + (trampoline_params - trampoline_start) + 0, %eax
+	mov %eax, %cr3
+
+	# Set LME in IA32_EFER MSR
+	mov $0xc0000080, %ecx
+	rdmsr
+	or $0x100, %eax
+	wrmsr
+
+	# Set PG = 1 in %cr0, this enters compatibility mode
+	mov %cr0, %eax
+	or $0x80000000, %eax
+	mov %eax, %cr0
+
+	# Far jump to the 64 bit code segment makes long mode effective
+	ljmp $8, $TRAMPOLINE_BASE + (trampoline_64 - trampoline_start)
+
+.code64
+trampoline_64:
+	mov $16, %ax
+	mov %ax, %ds
+	mov %ax, %ss
+	mov %ax, %es
+	mov %ax, %fs
+	mov %ax, %gs
+
+	mov TRAMPOLINE_BASE + (trampoline_params - trampoline_start) + 8, %rsp
+	mov TRAMPOLINE_BASE + (trampoline_params - trampoline_start) + 4, %edi
+	mov TRAMPOLINE_BASE + (trampoline_params - trampoline_start) + 16, %rax
+	call *%rax
+
+	trampoline_halt:
+		cli
+		hlt
+	jmp trampoline_halt
+
+# The 64 bit code and the data segment have the same selectors as in the
+# GDT of stage 1, so that the BSP and the APs can share one IDT; the 32 bit
+# code segment is only needed on the way
+.align 8
+trampoline_gdt:
+	segment_descriptor 0, 0, 0
+	segment_descriptor 0, 0xfffff, SD_SEGTYPE_CODE_RX | SD_P | SD_G | SD_L
+	segment_descriptor 0, 0xfffff, SD_SEGTYPE_DATA_RW | SD_P | SD_DB | SD_G
+	segment_descriptor 0, 0xfffff, SD_SEGTYPE_CODE_RX | SD_P | SD_DB | SD_G
+trampoline_gdt_end:
+
+trampoline_gdt_desc:
+	.word trampoline_gdt_end - trampoline_gdt - 1
+	.long TRAMPOLINE_BASE + (trampoline_gdt - trampoline_start)
+
+.align 8
+trampoline_params:
+	.long 0			# cr3
+	.long 0			# cpu_index
+	.quad 0			# stack
+	.quad 0			# entry
+trampoline_end:
+
+.section	.note.GNU-stack,"",@progbits
@@ -0,0 +1,120 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "longmode_example_stage2_acpi.h"
+#include "longmode_example_common_bootinfo.h"
+#include "longmode_example_common_string.h"
+
+#define BDA_EBDA_SEGMENT		0x40e
+#define EBDA_SEARCH_LENGTH		1024
+#define BIOS_AREA_START			0xe0000
+#define BIOS_AREA_END			0x100000
+
+struct acpi_rsdp_t {
+	char signature[8];
+	uint8_t checksum;
+	char oem_id[6];
+	uint8_t revision;
+	uint32_t rsdt_address;
+	/* ACPI 2.0 and later */
+	uint32_t length;
+	uint64_t xsdt_address;
+	uint8_t extended_checksum;
+	uint8_t reserved[3];
+} __attribute__ ((packed));
+
+static struct {
+	const struct acpi_sdt_header_t *root;
+	unsigned int entry_size;		/* 4 for the RSDT, 8 for the XSDT */
+} acpi;
+
+/* ACPI tables are accessed through the physical memory map */
+static const void *acpi_phys(uint64_t phys_addr) {
+	return (const void*)(PHYSMAP_BASE + phys_addr);
+}
+
+static bool acpi_checksum_ok(const void *data, size_t length) {
+	const uint8_t *bytes = data;
+	uint8_t sum = 0;
+	for (size_t i = 0; i < length; i++) {
+		sum += bytes[i];
+	}
+	return sum == 0;
+}
+
+/* The RSDP is on a 16 byte boundary in the first kiB of the EBDA or in the
+ * BIOS area below 1 MiB */
+static const struct acpi_rsdp_t *acpi_scan_rsdp(uint64_t start, uint64_t end) {
+	for (uint64_t phys_addr = start; phys_addr < end; phys_addr += 16) {
+		const struct acpi_rsdp_t *rsdp = acpi_phys(phys_addr);
+		if ((memcmp(rsdp->signature, "RSD PTR ", 8) == 0) && acpi_checksum_ok(rsdp, 20)) {
+			return rsdp;
+		}
+	}
+	return NULL;
+}
+
+bool acpi_init(void) {
+	const uint64_t ebda = (uint64_t)*(const uint16_t*)acpi_phys(BDA_EBDA_SEGMENT) << 4;
+	const struct acpi_rsdp_t *rsdp = ebda ? acpi_scan_rsdp(ebda, ebda + EBDA_SEARCH_LENGTH) : NULL;
+	if (!rsdp) {
+		rsdp = acpi_scan_rsdp(BIOS_AREA_START, BIOS_AREA_END);
+	}
+	if (!rsdp) {
+		return false;
+	}
+
+	if ((rsdp->revision >= 2) && rsdp->xsdt_address && acpi_checksum_ok(rsdp, rsdp->length)) {
+		acpi.root = acpi_phys(rsdp->xsdt_address);
+		acpi.entry_size = 8;
+	} else {
+		acpi.root = acpi_phys(rsdp->rsdt_address);
+		acpi.entry_size = 4;
+	}
+	if (!acpi_checksum_ok(acpi.root, acpi.root->length)) {
+		acpi.root = NULL;
+		return false;
+	}
+	return true;
+}
+
+/* Returns the first table with the given signature whose checksum is
+ * correct, or NULL */
+const struct acpi_sdt_header_t *acpi_find_table(const char *signature) {
+	if (!acpi.root) {
+		return NULL;
+	}
+	const uint8_t *entries = (const uint8_t*)acpi.root + sizeof(struct acpi_sdt_header_t);
+	const unsigned int entry_count = (acpi.root->length - sizeof(struct acpi_sdt_header_t)) / acpi.entry_size;
+	for (unsigned int i = 0; i < entry_count; i++) {
+		const uint64_t phys_addr = (acpi.entry_size == 8) ? *(const uint64_t*)(entries + (8 * i)) : *(const uint32_t*)(entries + (4 * i));
+		const struct acpi_sdt_header_t *table = acpi_phys(phys_addr);
+		if ((memcmp(table->signature, signature, 4) == 0) && acpi_checksum_ok(table, table->length)) {
+			return table;
+		}
+	}
+	return NULL;
+}
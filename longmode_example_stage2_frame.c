@@ -0,0 +1,164 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "longmode_example_stage2_frame.h"
+#include "longmode_example_common_console.h"
+
+/* One bit per frame, set means the frame is in use */
+static struct {
+	uint64_t *bitmap;
+	uint64_t frame_count;
+	uint64_t free_count;
+} frames;
+
+static void fill_qwords(uint64_t *target, uint64_t value, size_t count) {
+	__asm__ __volatile__("rep stosq" : "+D"(target), "+c"(count) : "a"(value) : "memory");
+}
+
+static bool frame_is_used(uint64_t frame) {
+	return frames.bitmap[frame / 64] & (1ULL << (frame % 64));
+}
+
+static void frame_mark(uint64_t first, uint64_t count, bool used) {
+	const uint64_t end = (first + count < frames.frame_count) ? first + count : frames.frame_count;
+	for (uint64_t frame = first; frame < end; frame++) {
+		const uint64_t mask = 1ULL << (frame % 64);
+		if (used && !frame_is_used(frame)) {
+			frames.bitmap[frame / 64] |= mask;
+			frames.free_count--;
+		} else if (!used && frame_is_used(frame)) {
+			frames.bitmap[frame / 64] &= ~mask;
+			frames.free_count++;
+		}
+	}
+}
+
+static void frame_reserve(uint64_t phys_start, uint64_t phys_end) {
+	const uint64_t first = phys_start / FRAME_SIZE;
+	frame_mark(first, ((phys_end + FRAME_SIZE - 1) / FRAME_SIZE) - first, true);
+}
+
+static bool overlaps(uint64_t start, uint64_t end, uint64_t other_start, uint64_t other_end) {
+	return (start < other_end) && (other_start < end);
+}
+
+/* Place the bitmap in the first piece of RAM above the loader that is not
+ * part of the stage 2 window */
+static bool frame_place_bitmap(const struct bootinfo_t *bootinfo, uint64_t size, uint64_t *phys_addr) {
+	const uint64_t window_end = bootinfo->stage2_phys_base + bootinfo->stage2_window_size;
+	for (unsigned int i = 0; i < bootinfo->e820_count; i++) {
+		const struct e820_entry_t *entry = &bootinfo->e820[i];
+		if (entry->type != E820_TYPE_RAM) {
+			continue;
+		}
+		uint64_t start = (entry->base > BOOTINFO_LOADER_END) ? entry->base : BOOTINFO_LOADER_END;
+		start = (start + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+		if (overlaps(start, start + size, bootinfo->stage2_phys_base, window_end)) {
+			start = window_end;
+		}
+		if (start + size <= entry->base + entry->length) {
+			*phys_addr = start;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Build the frame bitmap from the memory map: only whole frames inside RAM
+ * entries are free, minus the loader, the stage 2 window and the bitmap
+ * itself. Memory is accessed through the physical memory map of stage 1. */
+bool frame_init(const struct bootinfo_t *bootinfo) {
+	for (unsigned int i = 0; i < bootinfo->e820_count; i++) {
+		const struct e820_entry_t *entry = &bootinfo->e820[i];
+		if ((entry->type == E820_TYPE_RAM) && ((entry->base + entry->length) / FRAME_SIZE > frames.frame_count)) {
+			frames.frame_count = (entry->base + entry->length) / FRAME_SIZE;
+		}
+	}
+
+	const uint64_t bitmap_words = (frames.frame_count + 63) / 64;
+	uint64_t bitmap_phys;
+	if (!frame_place_bitmap(bootinfo, bitmap_words * sizeof(uint64_t), &bitmap_phys)) {
+		return false;
+	}
+	frames.bitmap = (uint64_t*)(PHYSMAP_BASE + bitmap_phys);
+	fill_qwords(frames.bitmap, ~0ULL, bitmap_words);
+	frames.free_count = 0;
+
+	for (unsigned int i = 0; i < bootinfo->e820_count; i++) {
+		const struct e820_entry_t *entry = &bootinfo->e820[i];
+		if (entry->type == E820_TYPE_RAM) {
+			const uint64_t first = (entry->base + FRAME_SIZE - 1) / FRAME_SIZE;
+			const uint64_t end = (entry->base + entry->length) / FRAME_SIZE;
+			if (end > first) {
+				frame_mark(first, end - first, false);
+			}
+		}
+	}
+	frame_reserve(0, BOOTINFO_LOADER_END);
+	frame_reserve(bootinfo->stage2_phys_base, bootinfo->stage2_phys_base + bootinfo->stage2_window_size);
+	frame_reserve(bitmap_phys, bitmap_phys + (bitmap_words * sizeof(uint64_t)));
+	return true;
+}
+
+/* First fit search for "count" physically contiguous frames, skipping fully
+ * used bitmap words. Returns the physical address or 0 if there is no such
+ * run; frame 0 is never handed out. */
+uint64_t frame_alloc(uint64_t count) {
+	uint64_t run_start = 0;
+	uint64_t run_length = 0;
+	if (count == 0) {
+		return 0;
+	}
+	for (uint64_t frame = 0; frame < frames.frame_count; ) {
+		if (((frame % 64) == 0) && (frames.bitmap[frame / 64] == ~0ULL)) {
+			run_length = 0;
+			frame += 64;
+			continue;
+		}
+		if (frame_is_used(frame)) {
+			run_length = 0;
+		} else {
+			if (run_length == 0) {
+				run_start = frame;
+			}
+			run_length++;
+			if (run_length == count) {
+				frame_mark(run_start, count, true);
+				return run_start * FRAME_SIZE;
+			}
+		}
+		frame++;
+	}
+	return 0;
+}
+
+void frame_free(uint64_t phys_addr, uint64_t count) {
+	frame_mark(phys_addr / FRAME_SIZE, count, false);
+}
+
+uint64_t frame_free_count(void) {
+	return frames.free_count;
+}
@@ -0,0 +1,169 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage2_interrupt.h"
+#include "longmode_example_stage2_lapic.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_serial.h"
+
+#define IDT_ENTRY_COUNT			256
+#define IDT_CODE_SELECTOR		8			/* 64 bit code segment of stage 1 and of the AP trampoline */
+#define IDT_TYPE_INTERRUPT_GATE	0x8e		/* Present, DPL 0, 64 bit interrupt gate */
+
+struct idt_entry_t {
+	uint16_t offset_low;
+	uint16_t selector;
+	uint8_t ist;
+	uint8_t type_attributes;
+	uint16_t offset_mid;
+	uint32_t offset_high;
+	uint32_t reserved;
+} __attribute__ ((packed));
+
+struct idt_descriptor_t {
+	uint16_t limit;
+	uint64_t base;
+} __attribute__ ((packed));
+
+struct interrupt_frame_t {
+	uint64_t rip;
+	uint64_t cs;
+	uint64_t rflags;
+	uint64_t rsp;
+	uint64_t ss;
+};
+
+static struct idt_entry_t idt[IDT_ENTRY_COUNT] __attribute__ ((aligned(16)));
+static volatile uint64_t timer_tick_count;
+
+static void __attribute__ ((noreturn)) exception_fatal(unsigned int vector, uint64_t error_code, const struct interrupt_frame_t *frame) {
+	printmsg("stage2: exception ");
+	print_decimal(vector);
+	printmsg(" error code ");
+	print_uint64(error_code);
+	printmsg(" at RIP ");
+	print_uint64(frame->rip);
+	printmsg(", halting\n");
+	while (true) {
+		__asm__ __volatile__("cli; hlt");
+	}
+}
+
+#define EXCEPTION_HANDLER(vector)																			\
+	static void __attribute__ ((interrupt)) exception_handler_ ## vector(struct interrupt_frame_t *frame) {	\
+		exception_fatal(vector, 0, frame);																	\
+	}
+#define EXCEPTION_HANDLER_ERROR_CODE(vector)																					\
+	static void __attribute__ ((interrupt)) exception_handler_ ## vector(struct interrupt_frame_t *frame, uint64_t error_code) {	\
+		exception_fatal(vector, error_code, frame);																				\
+	}
+
+EXCEPTION_HANDLER(0) EXCEPTION_HANDLER(1) EXCEPTION_HANDLER(2) EXCEPTION_HANDLER(3)
+EXCEPTION_HANDLER(4) EXCEPTION_HANDLER(5) EXCEPTION_HANDLER(6) EXCEPTION_HANDLER(7)
+EXCEPTION_HANDLER_ERROR_CODE(8) EXCEPTION_HANDLER(9) EXCEPTION_HANDLER_ERROR_CODE(10) EXCEPTION_HANDLER_ERROR_CODE(11)
+EXCEPTION_HANDLER_ERROR_CODE(12) EXCEPTION_HANDLER_ERROR_CODE(13) EXCEPTION_HANDLER_ERROR_CODE(14) EXCEPTION_HANDLER(15)
+EXCEPTION_HANDLER(16) EXCEPTION_HANDLER_ERROR_CODE(17) EXCEPTION_HANDLER(18) EXCEPTION_HANDLER(19)
+EXCEPTION_HANDLER(20) EXCEPTION_HANDLER_ERROR_CODE(21) EXCEPTION_HANDLER(22) EXCEPTION_HANDLER(23)
+EXCEPTION_HANDLER(24) EXCEPTION_HANDLER(25) EXCEPTION_HANDLER(26) EXCEPTION_HANDLER(27)
+EXCEPTION_HANDLER(28) EXCEPTION_HANDLER_ERROR_CODE(29) EXCEPTION_HANDLER_ERROR_CODE(30) EXCEPTION_HANDLER(31)
+
+static const void *exception_handlers[32] = {
+	exception_handler_0, exception_handler_1, exception_handler_2, exception_handler_3,
+	exception_handler_4, exception_handler_5, exception_handler_6, exception_handler_7,
+	exception_handler_8, exception_handler_9, exception_handler_10, exception_handler_11,
+	exception_handler_12, exception_handler_13, exception_handler_14, exception_handler_15,
+	exception_handler_16, exception_handler_17, exception_handler_18, exception_handler_19,
+	exception_handler_20, exception_handler_21, exception_handler_22, exception_handler_23,
+	exception_handler_24, exception_handler_25, exception_handler_26, exception_handler_27,
+	exception_handler_28, exception_handler_29, exception_handler_30, exception_handler_31,
+};
+
+static void __attribute__ ((interrupt)) timer_handler(struct interrupt_frame_t *frame) {
+	timer_tick_count++;
+	serial_poll();
+	lapic_eoi();
+}
+
+/* Only there to interrupt hlt, see smp_run_on() */
+static void __attribute__ ((interrupt)) wakeup_handler(struct interrupt_frame_t *frame) {
+	lapic_eoi();
+}
+
+/* Spurious interrupts must not be acknowledged */
+static void __attribute__ ((interrupt)) spurious_handler(struct interrupt_frame_t *frame) {
+}
+
+static void idt_set_handler(unsigned int vector, const void *handler) {
+	uint64_t offset = (uint64_t)handler;
+	idt[vector] = (struct idt_entry_t) {
+		.offset_low = (offset >> 0) & 0xffff,
+		.selector = IDT_CODE_SELECTOR,
+		.type_attributes = IDT_TYPE_INTERRUPT_GATE,
+		.offset_mid = (offset >> 16) & 0xffff,
+		.offset_high = (offset >> 32) & 0xffffffff,
+	};
+}
+
+/* All CPUs share the one IDT */
+void interrupt_load_idt(void) {
+	struct idt_descriptor_t idt_descriptor = {
+		.limit = sizeof(idt) - 1,
+		.base = (uint64_t)idt,
+	};
+	__asm__ __volatile__("lidt %0" : : "m"(idt_descriptor));
+}
+
+/* Stage 1 masked the legacy PIC before entering stage 2, so only local
+ * APIC interrupts are ever delivered */
+void interrupt_init(void) {
+	for (unsigned int vector = 0; vector < 32; vector++) {
+		idt_set_handler(vector, exception_handlers[vector]);
+	}
+	idt_set_handler(INTERRUPT_VECTOR_TIMER, timer_handler);
+	idt_set_handler(INTERRUPT_VECTOR_WAKEUP, wakeup_handler);
+	idt_set_handler(INTERRUPT_VECTOR_SPURIOUS, spurious_handler);
+	interrupt_load_idt();
+}
+
+/* Start the periodic local APIC timer on the calling CPU and enable
+ * interrupts */
+bool timer_init(void) {
+	const uint64_t timer_hz = lapic_timer_start(INTERRUPT_VECTOR_TIMER, TIMER_HZ);
+	if (!timer_hz) {
+		printmsg("stage2: local APIC timer not usable\n");
+		return false;
+	}
+	printmsg("stage2: local APIC timer ticks at ");
+	print_decimal(TIMER_HZ);
+	printmsg(" Hz, input clock ");
+	print_decimal(timer_hz / 1000);
+	printmsg(" kHz\n");
+	__asm__ __volatile__("sti");
+	return true;
+}
+
+uint64_t timer_ticks(void) {
+	return timer_tick_count;
+}
@@ -0,0 +1,43 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_STAGE2_INTERRUPT_H__
+#define __LONGMODE_EXAMPLE_STAGE2_INTERRUPT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define INTERRUPT_VECTOR_TIMER		0x20		/* Local APIC timer, follows the CPU exceptions */
+#define INTERRUPT_VECTOR_WAKEUP		0x21		/* IPI that ends the hlt of a parked AP */
+#define INTERRUPT_VECTOR_SPURIOUS	0xff
+
+#define TIMER_HZ					100
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+void interrupt_load_idt(void);
+void interrupt_init(void);
+bool timer_init(void);
+uint64_t timer_ticks(void);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
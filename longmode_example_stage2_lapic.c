@@ -0,0 +1,114 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage2_lapic.h"
+#include "longmode_example_common_bootinfo.h"
+#include "longmode_example_common_io.h"
+#include "longmode_example_common_tsc.h"
+
+#define IA32_APIC_BASE			0x1b
+#define APIC_BASE_ADDR_MASK		0xffffffffff000ULL
+
+#define LAPIC_ID				0x020
+#define LAPIC_EOI				0x0b0
+#define LAPIC_SVR				0x0f0
+#define LAPIC_SVR_ENABLE		(1 << 8)
+#define LAPIC_ICR_LOW			0x300
+#define LAPIC_ICR_HIGH			0x310
+#define LAPIC_ICR_PENDING		(1 << 12)
+#define LAPIC_LVT_TIMER			0x320
+#define LAPIC_LVT_MASKED		(1 << 16)
+#define LAPIC_LVT_PERIODIC		(1 << 17)
+#define LAPIC_TIMER_INITIAL		0x380
+#define LAPIC_TIMER_CURRENT		0x390
+#define LAPIC_TIMER_DIVIDE		0x3e0
+#define LAPIC_TIMER_DIVIDE_16	0x3
+
+#define TIMER_CALIBRATION_US	10000
+
+static struct {
+	volatile uint8_t *base;
+	uint64_t timer_hz;				/* Timer input clock after the divider */
+} lapic;
+
+static uint32_t lapic_read(unsigned int reg) {
+	return mmio_read32(lapic.base, reg);
+}
+
+static void lapic_write(unsigned int reg, uint32_t value) {
+	mmio_write32(lapic.base, reg, value);
+}
+
+/* Software enable the local APIC of the calling CPU. All CPUs share the
+ * same physical base address, which is mapped uncached by the physmap. */
+void lapic_init(unsigned int spurious_vector) {
+	if (!lapic.base) {
+		lapic.base = (volatile uint8_t*)(PHYSMAP_BASE + (rdmsr(IA32_APIC_BASE) & APIC_BASE_ADDR_MASK));
+	}
+	lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | spurious_vector);
+}
+
+uint8_t lapic_id(void) {
+	return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint32_t command) {
+	lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+	lapic_write(LAPIC_ICR_LOW, command);
+	while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+		cpu_relax();
+	}
+}
+
+void lapic_eoi(void) {
+	lapic_write(LAPIC_EOI, 0);
+}
+
+/* The timer runs off the bus or core crystal clock, whose frequency is not
+ * known; count it against the calibrated TSC */
+static uint64_t lapic_timer_calibrate(void) {
+	lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_TIMER_INITIAL, 0xffffffff);
+	delay_us(TIMER_CALIBRATION_US);
+	const uint32_t elapsed = 0xffffffff - lapic_read(LAPIC_TIMER_CURRENT);
+	lapic_write(LAPIC_TIMER_INITIAL, 0);
+	return (uint64_t)elapsed * (1000000 / TIMER_CALIBRATION_US);
+}
+
+/* Raise "vector" on the calling CPU "hz" times per second. Returns the
+ * timer input frequency, 0 if it could not be determined. */
+uint64_t lapic_timer_start(unsigned int vector, unsigned int hz) {
+	if (!lapic.timer_hz) {
+		lapic.timer_hz = lapic_timer_calibrate();
+	}
+	if ((lapic.timer_hz / hz) == 0) {
+		return 0;
+	}
+	lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_PERIODIC | vector);
+	lapic_write(LAPIC_TIMER_INITIAL, lapic.timer_hz / hz);
+	return lapic.timer_hz;
+}
@@ -0,0 +1,41 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_STAGE2_LAPIC_H__
+#define __LONGMODE_EXAMPLE_STAGE2_LAPIC_H__
+
+#include <stdint.h>
+
+#define LAPIC_ICR_INIT			(5 << 8)
+#define LAPIC_ICR_STARTUP		(6 << 8)
+#define LAPIC_ICR_ASSERT		(1 << 14)
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+void lapic_init(unsigned int spurious_vector);
+uint8_t lapic_id(void);
+void lapic_send_ipi(uint8_t apic_id, uint32_t command);
+void lapic_eoi(void);
+uint64_t lapic_timer_start(unsigned int vector, unsigned int hz);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -0,0 +1,113 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "longmode_example_stage2_memzero.h"
+#include "longmode_example_stage2_sched.h"
+#include "longmode_example_common_string.h"
+#include "longmode_example_common_cpu.h"
+
+/* Below this size the target is likely to be used soon and fits into the
+ * caches, so plain stores are better than bypassing the caches */
+#define MEMZERO_NONTEMPORAL_THRESHOLD	(1024 * 1024)
+#define MEMZERO_PARALLEL_GRAIN			(2 * 1024 * 1024)
+
+/* The nontemporal stores go to the write combining buffers instead of
+ * pulling every cache line in first. Each kernel zeroes "blocks" aligned 32
+ * byte blocks, at least one. */
+static void zero_blocks_movnti(void *target, size_t blocks) {
+	__asm__ __volatile__(
+		"1:"							"\n\t"
+		"movnti %2, 0(%0)"				"\n\t"
+		"movnti %2, 8(%0)"				"\n\t"
+		"movnti %2, 16(%0)"				"\n\t"
+		"movnti %2, 24(%0)"				"\n\t"
+		"add $32, %0"					"\n\t"
+		"dec %1"						"\n\t"
+		"jnz 1b"
+		: "+r"(target), "+r"(blocks) : "r"(0ULL) : "memory", "cc");
+}
+
+static void __attribute__ ((target ("sse2"))) zero_blocks_sse2(void *target, size_t blocks) {
+	__asm__ __volatile__(
+		"pxor %%xmm0, %%xmm0"			"\n\t"
+		"1:"							"\n\t"
+		"movntdq %%xmm0, 0(%0)"			"\n\t"
+		"movntdq %%xmm0, 16(%0)"		"\n\t"
+		"add $32, %0"					"\n\t"
+		"dec %1"						"\n\t"
+		"jnz 1b"
+		: "+r"(target), "+r"(blocks) : : "xmm0", "memory", "cc");
+}
+
+static void __attribute__ ((target ("avx"))) zero_blocks_avx(void *target, size_t blocks) {
+	__asm__ __volatile__(
+		"vpxor %%xmm0, %%xmm0, %%xmm0"	"\n\t"
+		"1:"							"\n\t"
+		"vmovntdq %%ymm0, (%0)"			"\n\t"
+		"add $32, %0"					"\n\t"
+		"dec %1"						"\n\t"
+		"jnz 1b"						"\n\t"
+		"vzeroupper"
+		: "+r"(target), "+r"(blocks) : : "xmm0", "memory", "cc");
+}
+
+static void zero_nontemporal(void *target, size_t length) {
+	uint8_t *bytes = target;
+	const size_t head = (32 - ((uintptr_t)bytes & 31)) & 31;
+	memset(bytes, 0, head);
+	bytes += head;
+	length -= head;
+
+	const size_t blocks = length / 32;
+	if (blocks > 0) {
+		if (cpu_has(CPU_FEATURE_AVX)) {
+			zero_blocks_avx(bytes, blocks);
+		} else if (cpu_has(CPU_FEATURE_SSE2)) {
+			zero_blocks_sse2(bytes, blocks);
+		} else {
+			zero_blocks_movnti(bytes, blocks);
+		}
+	}
+	memset(bytes + (blocks * 32), 0, length % 32);
+	__asm__ __volatile__("sfence" : : : "memory");
+}
+
+void memzero(void *target, size_t length) {
+	if (length < MEMZERO_NONTEMPORAL_THRESHOLD) {
+		memset(target, 0, length);
+	} else {
+		zero_nontemporal(target, length);
+	}
+}
+
+static void memzero_range(uint64_t begin, uint64_t end, void *argument) {
+	memzero((uint8_t*)argument + begin, end - begin);
+}
+
+/* Split the range into pieces of at most 2 MiB and zero them on all
+ * scheduler workers */
+void memzero_parallel(void *target, size_t length) {
+	sched_parallel_for(0, length, MEMZERO_PARALLEL_GRAIN, memzero_range, target);
+}
@@ -0,0 +1,233 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "longmode_example_stage2_sched.h"
+#include "longmode_example_stage2_smp.h"
+#include "longmode_example_common_io.h"
+
+/* Chase-Lev work-stealing deque, with the memory orderings of Le et al.,
+ * "Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013).
+ * The owning CPU pushes and takes at the bottom, thieves steal from the
+ * top. */
+struct sched_deque_t {
+	int64_t top;
+	uint8_t padding_top[56];
+	int64_t bottom;
+	uint8_t padding_bottom[56];
+	struct sched_task_t *tasks[SCHED_DEQUE_SIZE];
+} __attribute__ ((aligned(64)));
+
+struct sched_range_t {
+	uint64_t begin, end, grain;
+	sched_range_fnc_t fnc;
+	void *argument;
+};
+
+static struct {
+	struct sched_deque_t deque[SMP_MAX_CPUS];
+	unsigned int worker_count;		/* CPUs 0 up to worker_count - 1 take part */
+	bool stop;
+} sched;
+
+static bool deque_push(struct sched_deque_t *deque, struct sched_task_t *task) {
+	const int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+	const int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	if (bottom - top >= SCHED_DEQUE_SIZE) {
+		return false;
+	}
+	__atomic_store_n(&deque->tasks[bottom % SCHED_DEQUE_SIZE], task, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+static struct sched_task_t *deque_take(struct sched_deque_t *deque) {
+	const int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+	if (top > bottom) {
+		/* Empty */
+		__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	struct sched_task_t *task = __atomic_load_n(&deque->tasks[bottom % SCHED_DEQUE_SIZE], __ATOMIC_RELAXED);
+	if (top == bottom) {
+		/* Last task, race against thieves for it */
+		if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			task = NULL;
+		}
+		__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+	}
+	return task;
+}
+
+static struct sched_task_t *deque_steal(struct sched_deque_t *deque) {
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	const int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+	if (top >= bottom) {
+		return NULL;
+	}
+	struct sched_task_t *task = __atomic_load_n(&deque->tasks[top % SCHED_DEQUE_SIZE], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		/* Lost the race against the owner or another thief */
+		return NULL;
+	}
+	return task;
+}
+
+static void sched_execute(struct sched_task_t *task) {
+	task->fnc(task->argument);
+	__atomic_sub_fetch(&task->group->pending, 1, __ATOMIC_RELEASE);
+}
+
+/* Try every other worker once, starting at a pseudo-random victim */
+static struct sched_task_t *sched_steal(unsigned int self, uint32_t *random_state) {
+	const unsigned int worker_count = __atomic_load_n(&sched.worker_count, __ATOMIC_RELAXED);
+	*random_state ^= *random_state << 13;
+	*random_state ^= *random_state >> 17;
+	*random_state ^= *random_state << 5;
+	const unsigned int start = *random_state % worker_count;
+	for (unsigned int i = 0; i < worker_count; i++) {
+		const unsigned int victim = (start + i) % worker_count;
+		if (victim == self) {
+			continue;
+		}
+		struct sched_task_t *task = deque_steal(&sched.deque[victim]);
+		if (task) {
+			return task;
+		}
+	}
+	return NULL;
+}
+
+static struct sched_task_t *sched_find_task(unsigned int self, uint32_t *random_state) {
+	struct sched_task_t *task = deque_take(&sched.deque[self]);
+	return task ? task : sched_steal(self, random_state);
+}
+
+static void sched_worker(unsigned int cpu_index, void *argument) {
+	uint32_t random_state = 0x9e3779b9 ^ cpu_index;
+	while (!__atomic_load_n(&sched.stop, __ATOMIC_ACQUIRE)) {
+		struct sched_task_t *task = sched_find_task(cpu_index, &random_state);
+		if (task) {
+			sched_execute(task);
+		} else {
+			cpu_relax();
+		}
+	}
+}
+
+/* Let CPUs 0 up to worker_count - 1 execute tasks; the APs among them run
+ * sched_worker() until the worker count is changed again. The calling CPU
+ * (the BSP) works on tasks only while it is waiting in sched_sync(). */
+unsigned int sched_set_workers(unsigned int worker_count) {
+	if (worker_count > smp_cpu_count()) {
+		worker_count = smp_cpu_count();
+	}
+	if (worker_count < 1) {
+		worker_count = 1;
+	}
+
+	__atomic_store_n(&sched.stop, true, __ATOMIC_RELEASE);
+	for (unsigned int i = 1; i < sched.worker_count; i++) {
+		smp_wait(i);
+	}
+	__atomic_store_n(&sched.stop, false, __ATOMIC_RELAXED);
+	__atomic_store_n(&sched.worker_count, worker_count, __ATOMIC_RELEASE);
+	for (unsigned int i = 1; i < worker_count; i++) {
+		smp_run_on(i, sched_worker, NULL);
+	}
+	return worker_count;
+}
+
+void sched_init(void) {
+	sched.worker_count = 1;
+	sched_set_workers(smp_cpu_count());
+}
+
+void sched_spawn(struct sched_group_t *group, struct sched_task_t *task) {
+	task->group = group;
+	__atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+	if (!deque_push(&sched.deque[smp_cpu_index()], task)) {
+		sched_execute(task);
+	}
+}
+
+/* Wait until all tasks of the group have finished, executing tasks (of any
+ * group) in the meantime */
+void sched_sync(struct sched_group_t *group) {
+	const unsigned int self = smp_cpu_index();
+	uint32_t random_state = 0x2545f491 ^ self;
+	while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE)) {
+		struct sched_task_t *task = sched_find_task(self, &random_state);
+		if (task) {
+			sched_execute(task);
+		} else {
+			cpu_relax();
+		}
+	}
+}
+
+/* Split the range in halves until it is no larger than the grain size; one
+ * half is offered to thieves while this CPU continues with the other */
+static void sched_range_task(void *argument) {
+	struct sched_range_t *range = argument;
+	if (range->end - range->begin <= range->grain) {
+		range->fnc(range->begin, range->end, range->argument);
+		return;
+	}
+	const uint64_t middle = range->begin + ((range->end - range->begin) / 2);
+	struct sched_range_t upper = *range;
+	struct sched_range_t lower = *range;
+	upper.begin = middle;
+	lower.end = middle;
+
+	struct sched_group_t group = { 0 };
+	struct sched_task_t task = {
+		.fnc = sched_range_task,
+		.argument = &upper,
+	};
+	sched_spawn(&group, &task);
+	sched_range_task(&lower);
+	sched_sync(&group);
+}
+
+/* Call fnc for disjoint subranges of [begin, end) that are at most "grain"
+ * long, in parallel on all workers */
+void sched_parallel_for(uint64_t begin, uint64_t end, uint64_t grain, sched_range_fnc_t fnc, void *argument) {
+	struct sched_range_t range = {
+		.begin = begin,
+		.end = end,
+		.grain = grain ? grain : 1,
+		.fnc = fnc,
+		.argument = argument,
+	};
+	if (begin < end) {
+		sched_range_task(&range);
+	}
+}
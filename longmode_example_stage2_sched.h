@@ -0,0 +1,58 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_STAGE2_SCHED_H__
+#define __LONGMODE_EXAMPLE_STAGE2_SCHED_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Capacity of each per-CPU deque; a task spawned into a full deque is
+ * executed right away instead */
+#define SCHED_DEQUE_SIZE		256
+
+typedef void (*sched_fnc_t)(void *argument);
+typedef void (*sched_range_fnc_t)(uint64_t begin, uint64_t end, void *argument);
+
+/* Tasks that sched_sync() waits for */
+struct sched_group_t {
+	uint32_t pending;
+};
+
+/* Owned by the caller of sched_spawn() and must stay valid until the
+ * group has been synced */
+struct sched_task_t {
+	sched_fnc_t fnc;
+	void *argument;
+	struct sched_group_t *group;
+};
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+unsigned int sched_set_workers(unsigned int worker_count);
+void sched_init(void);
+void sched_spawn(struct sched_group_t *group, struct sched_task_t *task);
+void sched_sync(struct sched_group_t *group);
+void sched_parallel_for(uint64_t begin, uint64_t end, uint64_t grain, sched_range_fnc_t fnc, void *argument);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
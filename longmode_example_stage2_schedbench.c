@@ -0,0 +1,93 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage2_schedbench.h"
+#include "longmode_example_stage2_sched.h"
+#include "longmode_example_stage2_smp.h"
+#include "longmode_example_stage2_frame.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_bootinfo.h"
+#include "longmode_example_common_io.h"
+
+#define SCHEDBENCH_FRAMES		8192		/* 32 MiB */
+#define SCHEDBENCH_GRAIN		8192		/* 64 kiB per task */
+
+struct schedbench_t {
+	const uint64_t *data;
+	uint64_t result;
+};
+
+/* FNV-1a style hash over 64 bit words, combined order-independently so
+ * that every worker count has to produce the same result */
+static void schedbench_hash(uint64_t begin, uint64_t end, void *argument) {
+	struct schedbench_t *bench = argument;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (uint64_t i = begin; i < end; i++) {
+		hash = (hash ^ bench->data[i]) * 0x100000001b3ULL;
+	}
+	__atomic_add_fetch(&bench->result, hash, __ATOMIC_RELAXED);
+}
+
+/* Hash a buffer with 1 up to all CPUs and report the speedup over a single
+ * CPU */
+void schedbench_run(void) {
+	const uint64_t buffer = frame_alloc(SCHEDBENCH_FRAMES);
+	if (!buffer) {
+		printmsg("stage2: not enough memory for the scheduler benchmark\n");
+		return;
+	}
+	const uint64_t word_count = SCHEDBENCH_FRAMES * FRAME_SIZE / sizeof(uint64_t);
+	struct schedbench_t bench = {
+		.data = (const uint64_t*)(PHYSMAP_BASE + buffer),
+	};
+
+	uint64_t single_cpu_cycles = 0;
+	uint64_t single_cpu_result = 0;
+	for (unsigned int workers = 1; workers <= smp_cpu_count(); workers++) {
+		sched_set_workers(workers);
+		bench.result = 0;
+		const uint64_t t_start = rdtsc();
+		sched_parallel_for(0, word_count, SCHEDBENCH_GRAIN, schedbench_hash, &bench);
+		const uint64_t cycles = rdtsc() - t_start;
+		if (workers == 1) {
+			single_cpu_cycles = cycles;
+			single_cpu_result = bench.result;
+		}
+		const uint64_t speedup_percent = single_cpu_cycles * 100 / (cycles ? cycles : 1);
+
+		printmsg("stage2: sched ");
+		print_decimal(workers);
+		printmsg(" CPUs: ");
+		print_decimal(cycles);
+		printmsg(" cycles, speedup ");
+		print_decimal(speedup_percent / 100);
+		printmsg(".");
+		print_decimal((speedup_percent / 10) % 10);
+		print_decimal(speedup_percent % 10);
+		printmsg((bench.result == single_cpu_result) ? "\n" : ", RESULT MISMATCH\n");
+	}
+	sched_set_workers(smp_cpu_count());
+	frame_free(buffer, SCHEDBENCH_FRAMES);
+}
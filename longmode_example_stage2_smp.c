@@ -0,0 +1,241 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "longmode_example_stage2_smp.h"
+#include "longmode_example_stage2_acpi.h"
+#include "longmode_example_stage2_frame.h"
+#include "longmode_example_stage2_lapic.h"
+#include "longmode_example_stage2_interrupt.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_bootinfo.h"
+#include "longmode_example_common_paging.h"
+#include "longmode_example_common_io.h"
+#include "longmode_example_common_tsc.h"
+
+#define IA32_GS_BASE			0xc0000101
+
+#define MADT_LOCAL_APIC			0
+#define MADT_LAPIC_ENABLED		(1 << 0)
+#define MADT_LAPIC_ONLINE_CAPABLE	(1 << 1)
+
+#define AP_STARTUP_TIMEOUT_MS	100
+
+struct madt_t {
+	struct acpi_sdt_header_t header;
+	uint32_t lapic_address;
+	uint32_t flags;
+	uint8_t entries[];
+} __attribute__ ((packed));
+
+struct madt_local_apic_t {
+	uint8_t type;
+	uint8_t length;
+	uint8_t acpi_processor_id;
+	uint8_t apic_id;
+	uint32_t flags;
+} __attribute__ ((packed));
+
+/* Layout of trampoline_params in longmode_example_stage2.s */
+struct trampoline_params_t {
+	uint32_t cr3;
+	uint32_t cpu_index;
+	uint64_t stack;
+	uint64_t entry;
+} __attribute__ ((packed));
+
+/* %gs points to the entry of the running CPU, see smp_cpu_index() */
+struct smp_cpu_t {
+	unsigned int index;
+	uint8_t apic_id;
+	bool online;
+	smp_work_fnc_t work;
+	void *argument;
+};
+
+extern const uint8_t trampoline_start[];
+extern const uint8_t trampoline_end[];
+extern const uint8_t trampoline_params[];
+
+static struct {
+	unsigned int cpu_count;			/* CPUs that are online, the BSP is CPU 0 */
+	struct smp_cpu_t cpu[SMP_MAX_CPUS];
+} smp;
+
+/* Per-CPU state that the BSP already has */
+static void smp_ap_setup(void) {
+	if (cpuid(CPUID_FEATURES, 0).edx & CPUID_EDX_PAT) {
+		wrmsr(IA32_PAT, PAT_LAYOUT);
+	}
+	interrupt_load_idt();
+	lapic_init(INTERRUPT_VECTOR_SPURIOUS);
+}
+
+/* Entered from the trampoline in long mode on the AP's own stack. APs are
+ * parked here, halted, and run whatever work smp_run_on() gives them. Work
+ * is checked with interrupts disabled and "sti; hlt" only recognizes
+ * interrupts once hlt has started, so the wakeup IPI cannot be missed. */
+static void smp_ap_main(unsigned int cpu_index) {
+	struct smp_cpu_t *cpu = &smp.cpu[cpu_index];
+	smp_ap_setup();
+	wrmsr(IA32_GS_BASE, (uint64_t)cpu);
+	__atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+	while (true) {
+		__asm__ __volatile__("cli" : : : "memory");
+		smp_work_fnc_t work = __atomic_load_n(&cpu->work, __ATOMIC_ACQUIRE);
+		if (!work) {
+			__asm__ __volatile__("sti; hlt" : : : "memory");
+			continue;
+		}
+		work(cpu_index, cpu->argument);
+		__atomic_store_n(&cpu->work, NULL, __ATOMIC_RELEASE);
+	}
+}
+
+/* INIT-SIPI-SIPI sequence, one AP at a time so that they can share the
+ * trampoline and its parameter block. On failure neither the parameter
+ * block nor the CPU slot may be handed to another AP. */
+static bool smp_start_ap(uint8_t apic_id) {
+	const unsigned int cpu_index = smp.cpu_count;
+	const uint64_t stack = frame_alloc(SMP_STACK_FRAMES);
+	if (!stack) {
+		return false;
+	}
+
+	volatile struct trampoline_params_t *params = (volatile struct trampoline_params_t*)(PHYSMAP_BASE + TRAMPOLINE_BASE + (trampoline_params - trampoline_start));
+	uint64_t cr3;
+	__asm__ __volatile__("mov %%cr3, %0" : "=r"(cr3));
+	params->cr3 = cr3;
+	params->cpu_index = cpu_index;
+	params->stack = PHYSMAP_BASE + stack + (SMP_STACK_FRAMES * FRAME_SIZE);
+	params->entry = (uint64_t)smp_ap_main;
+	smp.cpu[cpu_index] = (struct smp_cpu_t) {
+		.index = cpu_index,
+		.apic_id = apic_id,
+	};
+
+	lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+	delay_us(10000);
+	for (unsigned int sipi = 0; sipi < 2; sipi++) {
+		lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | (TRAMPOLINE_BASE >> 12));
+		delay_us(200);
+		if (__atomic_load_n(&smp.cpu[cpu_index].online, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+	}
+	const uint64_t deadline = deadline_ns(AP_STARTUP_TIMEOUT_MS * 1000000ULL);
+	while (!deadline_expired(deadline)) {
+		if (__atomic_load_n(&smp.cpu[cpu_index].online, __ATOMIC_ACQUIRE)) {
+			smp.cpu_count++;
+			return true;
+		}
+		cpu_relax();
+	}
+	/* The AP may still come up late and run on this stack, so it stays
+	 * allocated */
+	return false;
+}
+
+/* Start all enabled processors that the ACPI MADT lists. Without a MADT
+ * stage 2 keeps running on the BSP only. */
+void smp_init(void) {
+	lapic_init(INTERRUPT_VECTOR_SPURIOUS);
+	const uint8_t bsp_apic_id = lapic_id();
+	smp.cpu[0] = (struct smp_cpu_t) {
+		.index = 0,
+		.apic_id = bsp_apic_id,
+		.online = true,
+	};
+	smp.cpu_count = 1;
+	wrmsr(IA32_GS_BASE, (uint64_t)&smp.cpu[0]);
+
+	const struct madt_t *madt = acpi_init() ? (const struct madt_t*)acpi_find_table("APIC") : NULL;
+	if (!madt) {
+		printmsg("stage2: no ACPI MADT, running on the BSP only\n");
+		return;
+	}
+
+	const uint8_t *madt_end = (const uint8_t*)madt + madt->header.length;
+	for (unsigned int i = 0; i < trampoline_end - trampoline_start; i++) {
+		((volatile uint8_t*)(PHYSMAP_BASE + TRAMPOLINE_BASE))[i] = trampoline_start[i];
+	}
+	unsigned int failed = 0;
+	for (const uint8_t *entry = madt->entries; (entry + 2 <= madt_end) && (entry[1] >= 2); entry += entry[1]) {
+		if (entry[0] != MADT_LOCAL_APIC) {
+			continue;
+		}
+		const struct madt_local_apic_t *local_apic = (const struct madt_local_apic_t*)entry;
+		/* Online capable processors without the enabled flag are not
+		 * present (hot plug) */
+		if (!(local_apic->flags & MADT_LAPIC_ENABLED) || (local_apic->apic_id == bsp_apic_id)) {
+			continue;
+		}
+		if (smp.cpu_count == SMP_MAX_CPUS) {
+			failed++;
+		} else if (!smp_start_ap(local_apic->apic_id)) {
+			printmsg("stage2: AP with APIC ID ");
+			print_decimal(local_apic->apic_id);
+			printmsg(" did not start, not starting any further APs\n");
+			failed++;
+			break;
+		}
+	}
+
+	printmsg("stage2: ");
+	print_decimal(smp.cpu_count);
+	printmsg(" CPUs online");
+	if (failed) {
+		printmsg(", ");
+		print_decimal(failed);
+		printmsg(" failed to start");
+	}
+	printmsg("\n");
+}
+
+/* Index of the running CPU, 0 for the BSP */
+unsigned int smp_cpu_index(void) {
+	unsigned int index;
+	__asm__ __volatile__("movl %%gs:0, %0" : "=r"(index));
+	return index;
+}
+
+unsigned int smp_cpu_count(void) {
+	return smp.cpu_count;
+}
+
+/* Hand work to a parked AP (cpu_index 1 up to smp_cpu_count() - 1) and
+ * wake it up; it must have finished its previous work */
+void smp_run_on(unsigned int cpu_index, smp_work_fnc_t work, void *argument) {
+	struct smp_cpu_t *cpu = &smp.cpu[cpu_index];
+	cpu->argument = argument;
+	__atomic_store_n(&cpu->work, work, __ATOMIC_RELEASE);
+	lapic_send_ipi(cpu->apic_id, INTERRUPT_VECTOR_WAKEUP);
+}
+
+void smp_wait(unsigned int cpu_index) {
+	while (__atomic_load_n(&smp.cpu[cpu_index].work, __ATOMIC_ACQUIRE)) {
+		cpu_relax();
+	}
+}
@@ -0,0 +1,45 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __LONGMODE_EXAMPLE_STAGE2_SMP_H__
+#define __LONGMODE_EXAMPLE_STAGE2_SMP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Must match longmode_example_stage2.s; the SIPI vector is the page number */
+#define TRAMPOLINE_BASE			0x1000
+#define SMP_MAX_CPUS			64
+#define SMP_STACK_FRAMES		4
+
+typedef void (*smp_work_fnc_t)(unsigned int cpu_index, void *argument);
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+void smp_init(void);
+unsigned int smp_cpu_index(void);
+unsigned int smp_cpu_count(void);
+void smp_run_on(unsigned int cpu_index, smp_work_fnc_t work, void *argument);
+void smp_wait(unsigned int cpu_index);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -0,0 +1,112 @@
+/*
+	toy_x64_bootloader - Minimal bootloader for x86_64 using long mode and PML4
+	Copyright (C) 2023-2023 Johannes Bauer
+
+	This file is part of toy_x64_bootloader.
+
+	toy_x64_bootloader is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	toy_x64_bootloader is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with toy_x64_bootloader; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "longmode_example_stage2_vgabench.h"
+#include "longmode_example_common_console.h"
+#include "longmode_example_common_paging.h"
+#include "longmode_example_common_io.h"
+
+#define VGA_TEXT_BUFFER			0xb8000
+#define VGA_TEXT_CELLS			(80 * 25)
+#define VGA_TEXT_PAGES			8			/* 0xb8000 up to 0xbffff */
+#define PAGE_SIZE_4K			4096
+#define FILL_ROUNDS				64
+
+static const struct {
+	const char *name;
+	uint64_t pte_bits;
+	bool needs_pat;
+} memory_types[] = {
+	{ .name = "UC", .pte_bits = PG_CACHE_UC },
+	{ .name = "WB", .pte_bits = PG_CACHE_WB },
+	{ .name = "WT", .pte_bits = PG_CACHE_WT_4K, .needs_pat = true },
+	{ .name = "WC", .pte_bits = PG_CACHE_WC, .needs_pat = true },
+};
+
+static uint16_t screen_copy[VGA_TEXT_CELLS];
+
+/* Change the memory type of the text buffer pages in the low page table
+ * that stage 1 built; the physical memory map shares that table, so there
+ * is no alias with a different type */
+static void vga_set_memory_type(volatile uint64_t *low_page_table, uint64_t pte_bits) {
+	for (unsigned int i = 0; i < VGA_TEXT_PAGES; i++) {
+		const unsigned int index = (VGA_TEXT_BUFFER / PAGE_SIZE_4K) + i;
+		low_page_table[index] = (low_page_table[index] & ~(uint64_t)PG_CACHE_MASK_4K) | pte_bits;
+		invlpg((const volatile void*)(uintptr_t)(VGA_TEXT_BUFFER + (i * PAGE_SIZE_4K)));
+	}
+	wbinvd();
+}
+
+/* Write the whole screen FILL_ROUNDS times, one character cell at a time.
+ * The current screen content is written back so the benchmark
+ * is invisible. */
+static uint64_t vga_fill_cycles(void) {
+	volatile uint16_t *screen = (volatile uint16_t*)VGA_TEXT_BUFFER;
+	const uint64_t t_start = rdtsc();
+	for (unsigned int round = 0; round < FILL_ROUNDS; round++) {
+		for (unsigned int i = 0; i < VGA_TEXT_CELLS; i++) {
+			screen[i] = screen_copy[i];
+		}
+	}
+	/* Drain the write-combining buffers before taking the time */
+	__asm__ __volatile__("sfence" : : : "memory");
+	return (rdtsc() - t_start) / FILL_ROUNDS;
+}
+
+/* Full screen fill throughput of the VGA text buffer under each memory type
+ * that the PAT layout of stage 1 offers */
+void vgabench_run(const struct bootinfo_t *bootinfo) {
+	volatile uint64_t *low_page_table = (volatile uint64_t*)(PHYSMAP_BASE + bootinfo->low_page_table);
+	const bool pat = (cpuid(CPUID_FEATURES, 0).edx & CPUID_EDX_PAT) && (rdmsr(IA32_PAT) == PAT_LAYOUT);
+	const uint64_t original_pte = low_page_table[VGA_TEXT_BUFFER / PAGE_SIZE_4K];
+	uint64_t cycles[sizeof(memory_types) / sizeof(memory_types[0])];
+
+	volatile uint16_t *screen = (volatile uint16_t*)VGA_TEXT_BUFFER;
+	for (unsigned int i = 0; i < VGA_TEXT_CELLS; i++) {
+		screen_copy[i] = screen[i];
+	}
+	for (unsigned int i = 0; i < sizeof(memory_types) / sizeof(memory_types[0]); i++) {
+		if (memory_types[i].needs_pat && !pat) {
+			cycles[i] = 0;
+			continue;
+		}
+		vga_set_memory_type(low_page_table, memory_types[i].pte_bits);
+		cycles[i] = vga_fill_cycles();
+	}
+	vga_set_memory_type(low_page_table, original_pte & PG_CACHE_MASK_4K);
+
+	printmsg("stage2: VGA fill cycles/screen:");
+	for (unsigned int i = 0; i < sizeof(memory_types) / sizeof(memory_types[0]); i++) {
+		printmsg(" ");
+		printmsg(memory_types[i].name);
+		printmsg(" ");
+		if (cycles[i]) {
+			print_decimal(cycles[i]);
+		} else {
+			printmsg("n/a");
+		}
+	}
+	printmsg("\n");
+}